@@ -8,64 +8,2919 @@
  * This demonstrates how the Composite pattern allows you to treat individual objects (files)
  * and compositions of objects (directories) uniformly. You can build complex tree structures
  * and perform operations (like showDetails) recursively on the whole structure.
+ *
+ * TreeTraversal walks a tree in pre-order, post-order or breadth-first order through an
+ * input iterator, keeping its position on an explicit, reusable TraversalStack instead of
+ * the call stack, so even pathologically deep trees can be shown, rendered and destroyed.
+ *
+ * FlatFilesystem is a compact alternative for very large trees: all nodes live in one
+ * contiguous arena addressed by 32-bit indices and linked as first-child/next-sibling,
+ * with every name stored in a single shared string blob.
+ *
+ * parallelReduce runs aggregate operations over a FilesystemComponent tree on a
+ * work-stealing thread pool, forking one task per large subtree.
+ *
+ * searchTree finds components by glob and/or predicate on the same pool, streaming matches
+ * as they turn up; each directory's index of the extensions below it lets "*.jpg"-style
+ * queries skip subtrees that cannot match. The index is a 64-bit filter: it prunes well
+ * for up to a few dozen distinct extensions per subtree and stops pruning, without ever
+ * missing a match, as it fills up.
+ *
+ * Directory::resolve looks up slash-separated paths, answering repeated lookups from a
+ * small LRU cache that is dropped whenever anything below the directory changes.
+ *
+ * Files carry a size, and every directory keeps its subtree totals (bytes, file count,
+ * depth) up to date on add/remove, so aggregate queries are O(1).
+ *
+ * importDirectory mirrors a directory tree from disk into Directory/File objects, scanning
+ * subdirectories in parallel. Run `make bench` to time it on a generated 1M-file tree.
+ *
+ * TreeRenderer writes a whole tree as text (the showDetails format) or JSON into one
+ * reusable buffer and hands it to the stream in large chunks.
+ *
+ * A Directory can also be lazy: a loader callback produces its children on first access,
+ * and a LazyDirectoryCache can evict loaded children again on an LRU basis.
+ *
+ * visitBatched applies a visitor to every node without a virtual call per node: nodes are
+ * grouped into batches of files and of directories, each processed in one plain loop, on
+ * either the pointer tree or a FlatFilesystem.
+ *
+ * measureMemory breaks the memory of a tree down by category (node objects, shared_ptr
+ * control blocks, name heap, child arrays, container slack, indexes), and
+ * FilesystemComponent::liveCount reports how many files and directories are alive.
+ *
+ * PersistentFilesystem keeps immutable versions of a tree (PersistentNode): a change copies
+ * only the directories on its path, so readers can hold cheap snapshots while a writer
+ * publishes new versions, and unreferenced versions are freed automatically.
+ *
+ * writeTreeFile saves a tree as one binary file (pre-order nodes with subtree sizes, plus
+ * a string table). MappedTree maps such a file and navigates it in place, and materializes
+ * a mutable Directory tree only when one is needed. `make bench` times the round trip.
  */
 
-#include <iostream>
-#include <memory>
-#include <vector>
-#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <filesystem>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+class Directory;
+class FlatFilesystem;
+class LazyDirectoryCache;
+class TreeTraversal;
+struct MemoryReport;
+
+// Component interface: FilesystemComponent
+class FilesystemComponent {
+public:
+    enum class Kind : std::uint8_t { File, Directory };
+
+private:
+    // Owning directory, maintained by Directory::add/remove
+    Directory* parent = nullptr;
+    Kind componentKind;
+    friend class Directory;
+
+    // Live objects of each kind, across all trees
+    static inline std::atomic<std::uint64_t> liveCounters[2] = {};
+
+protected:
+    explicit FilesystemComponent(Kind kind) : componentKind(kind) {
+        liveCounters[static_cast<int>(kind)].fetch_add(1, std::memory_order_relaxed);
+    }
+    // A copy starts out detached from any directory
+    FilesystemComponent(const FilesystemComponent& other) : FilesystemComponent(other.componentKind) {}
+    FilesystemComponent& operator=(const FilesystemComponent&) { return *this; }
+
+public:
+    // File or Directory, readable without a virtual call
+    Kind kind() const { return componentKind; }
+    // Number of Files or Directories currently alive
+    static std::uint64_t liveCount(Kind kind) {
+        return liveCounters[static_cast<int>(kind)].load(std::memory_order_relaxed);
+    }
+    // Method to display the component's name (with indentation for hierarchy)
+    virtual void showDetails(int indent = 0) const = 0;
+    // Returns the component's name
+    virtual const std::string& getName() const = 0;
+    // Returns this component as a Directory, or nullptr for leaves
+    virtual const Directory* asDirectory() const { return nullptr; }
+    // Returns the directory this component was added to, or nullptr
+    Directory* getParent() const { return parent; }
+    // Total bytes of all files in this subtree
+    virtual std::uint64_t totalBytes() const = 0;
+    // Number of files in this subtree
+    virtual std::uint64_t fileCount() const = 0;
+    // Levels below this component: 0 for a file or an empty directory
+    virtual std::uint32_t maxDepth() const = 0;
+    // Virtual destructor for safe polymorphic deletion
+    virtual ~FilesystemComponent() {
+        liveCounters[static_cast<int>(componentKind)].fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// Leaf: File
+class File final : public FilesystemComponent {
+private:
+    std::string name;
+    std::uint64_t size;
+public:
+    explicit File(std::string name, std::uint64_t size = 0)
+        : FilesystemComponent(Kind::File), name(std::move(name)), size(size) {}
+    const std::string& getName() const override { return name; }
+    std::uint64_t getSize() const { return size; }
+    std::uint64_t totalBytes() const override { return size; }
+    std::uint64_t fileCount() const override { return 1; }
+    std::uint32_t maxDepth() const override { return 0; }
+    // Displays the file's name with indentation
+    void showDetails(int indent = 0) const override;
+};
+
+// Key of the per-directory name index: one of 64 bits, picked by hashing the text after
+// the last '.' of a name. Names without a '.' have no bit.
+// The index is a one-hash, 64-bit Bloom filter, so it only prunes well while a subtree holds
+// a few dozen distinct extensions at most. With n distinct extensions below a directory,
+// about 1 - (63/64)^n of the bits are set, which is also the chance that a search for an
+// extension that is absent still descends: roughly 22% at 16 extensions, 40% at 32 and 64%
+// at 64. Near the root of a large, varied tree every bit is typically set. Pruning then stops,
+// but results stay correct, because the index never hides a match.
+inline std::uint64_t nameExtensionBit(std::string_view name) {
+    const std::size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos) {
+        return 0;
+    }
+    return std::uint64_t(1) << (std::hash<std::string_view>()(name.substr(dot + 1)) & 63);
+}
+
+// Calls fn(segment) for each segment of a slash-separated path, without copying any part of
+// it. Leading, trailing and doubled slashes are skipped. Stops as soon as fn returns false,
+// and returns false in that case.
+template <typename Fn>
+bool forEachPathSegment(std::string_view path, Fn fn) {
+    std::size_t start = 0;
+    while (start <= path.size()) {
+        std::size_t end = path.find('/', start);
+        if (end == std::string_view::npos) {
+            end = path.size();
+        }
+        std::string_view segment = path.substr(start, end - start);
+        start = end + 1;
+        if (!segment.empty() && !fn(segment)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Composite: Directory
+// Children are kept in insertion order. Removal clears a slot instead of shifting the
+// vector, and the slots are compacted once more than half of them are empty. Directories
+// larger than kIndexThreshold also keep an open-addressing table of child positions keyed
+// by name, so add, remove and find are O(1); small ones just scan their few children.
+class Directory final : public FilesystemComponent {
+private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+    static constexpr std::size_t kIndexThreshold = 16;
+    static constexpr std::uint32_t kEmptyEntry = 0xFFFFFFFFu;
+    static constexpr std::uint32_t kDeletedEntry = 0xFFFFFFFEu;
+
+    std::string name;
+    std::vector<std::shared_ptr<FilesystemComponent>> children;
+    std::size_t liveChildren = 0;
+    std::vector<std::uint32_t> index; // Positions in children; empty while below threshold
+    std::size_t indexUsed = 0;        // Index entries that are live or deleted
+
+    // Bumped on every add/remove in this directory or any directory below it
+    std::uint64_t subtreeVersion = 0;
+
+    // A subtree aggregate. Only one thread writes it at a time (add/remove, or a lazy load
+    // under lazyPropagationMutex) while searches on other threads may read it, so it is a
+    // relaxed atomic updated with plain loads and stores rather than locked instructions.
+    template <typename T>
+    struct Aggregate {
+        std::atomic<T> value{0};
+        operator T() const { return value.load(std::memory_order_relaxed); }
+        Aggregate& operator=(T v) {
+            value.store(v, std::memory_order_relaxed);
+            return *this;
+        }
+        Aggregate& operator=(const Aggregate& other) { return *this = T(other); }
+        Aggregate& operator+=(T delta) { return *this = T(*this) + delta; }
+        Aggregate& operator-=(T delta) { return *this = T(*this) - delta; }
+    };
+
+    // Subtree aggregates, maintained incrementally by propagateAdd/propagateRemove
+    Aggregate<std::uint64_t> bytes;
+    Aggregate<std::uint64_t> files;
+    Aggregate<std::uint32_t> depth;
+    // Direct children whose own depth + 1 equals `depth`; remove() only rescans the
+    // children when the last of them leaves
+    std::uint32_t deepestChildren = 0;
+    // Name index: the nameExtensionBit of every name below this directory, ORed together.
+    // add() sets bits; remove() leaves them (a stale bit only costs pruning) until compact().
+    // A lazy directory has all bits set until its first load. Atomic because lazy loads
+    // update ancestors while searches read them.
+    std::atomic<std::uint64_t> extensions{0};
+
+    // LRU cache of resolve() results, keyed by path hash; allocated on first use. Targets
+    // are weak, so a cached path never keeps a removed or evicted subtree alive.
+    struct PathCache {
+        struct Entry {
+            std::string path;
+            std::weak_ptr<FilesystemComponent> target;
+        };
+        std::list<Entry> entries; // Most recently used first
+        std::unordered_map<std::size_t, std::list<Entry>::iterator> byHash;
+        std::uint64_t version = 0;
+    };
+    mutable std::unique_ptr<PathCache> pathCache;
+    std::size_t pathCacheCapacity = 1024;
+
+public:
+    // Fills a lazy directory by calling add() on it
+    using Loader = std::function<void(Directory&)>;
+
+private:
+    // State of a lazy directory; plain directories leave `lazy` empty
+    struct LazyState {
+        Loader loader;
+        LazyDirectoryCache* cache;
+        std::recursive_mutex mutex;    // Held while loading or evicting
+        std::atomic<bool> loaded{false};
+        bool loading = false;
+        std::atomic<int> pins{0};      // Active forEachChild calls; pinned directories stay loaded
+        std::atomic<bool> evicting{false}; // Picked as a victim; destruction waits for the evictor
+        std::list<Directory*>::iterator lruPosition; // Guarded by the cache's mutex
+        bool inLru = false;
+        std::size_t chargedChildren = 0;
+    };
+    std::unique_ptr<LazyState> lazy;
+    friend class LazyDirectoryCache;
+    friend MemoryReport measureMemory(const FilesystemComponent& root);
+
+    // Keeps a lazy directory from being evicted while its children are being read. Taken
+    // before ensureLoaded(): an evictor that races with it sees the pin and backs off.
+    struct Pin {
+        LazyState* state;
+        explicit Pin(LazyState* state) : state(state) { if (state) ++state->pins; }
+        ~Pin() { if (state) --state->pins; }
+    };
+
+    // Serializes the ancestor updates made when lazy directories load or unload, and
+    // every change to the parent pointers of their children
+    static std::mutex& lazyPropagationMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    // Lazy directories alive in the process; while there are none, nothing walks parent
+    // pointers concurrently and teardown can skip lazyPropagationMutex
+    static std::atomic<std::size_t>& liveLazyDirectories() {
+        static std::atomic<std::size_t> count{0};
+        return count;
+    }
+
+    // Lazy directories whose loader is running, on any thread. Guarded by
+    // lazyPropagationMutex; eviction skips them and their ancestors.
+    static std::vector<const Directory*>& loadsInFlight() {
+        static std::vector<const Directory*> loads;
+        return loads;
+    }
+
+    // Runs the loader if this is a lazy directory that is not loaded yet
+    void ensureLoaded() const;
+    // Called with lazy->mutex held: runs the loader and merges the new totals into ancestors
+    void load();
+    // Called with lazy->mutex held: drops the children but keeps the subtree totals
+    void evict();
+
+    // Visits children that are already in memory, without loading or pinning
+    template <typename Fn>
+    void forEachLoadedChild(Fn&& fn) const {
+        for (const auto& child : children) {
+            if (child) {
+                fn(*child);
+            }
+        }
+    }
+
+    // Slot-level access for TreeTraversal, which keeps its position in children between
+    // steps instead of inside a callback. Returns the first live slot at or after `slot`.
+    std::size_t nextLiveSlot(std::size_t slot) const {
+        while (slot < children.size() && !children[slot]) {
+            ++slot;
+        }
+        return slot;
+    }
+    // Loads a directory and keeps it loaded until unpinTraversal(), for traversals that
+    // come back to its children later
+    void pinTraversal() const {
+        if (lazy) {
+            ++lazy->pins;
+            ensureLoaded();
+        }
+    }
+    void unpinTraversal() const {
+        if (lazy) {
+            --lazy->pins;
+        }
+    }
+    friend class TreeTraversal;
+
+    static std::size_t hashName(std::string_view childName) {
+        return std::hash<std::string_view>()(childName);
+    }
+
+    // Returns the position in children of the child with the given name, or npos
+    std::size_t findPosition(std::string_view childName) const {
+        if (index.empty()) {
+            for (std::size_t i = 0; i < children.size(); ++i) {
+                if (children[i] && children[i]->getName() == childName) {
+                    return i;
+                }
+            }
+            return npos;
+        }
+        std::size_t entry = findEntry(childName);
+        return entry == npos ? npos : index[entry];
+    }
+
+    // Returns the index entry holding the given name, or npos
+    std::size_t findEntry(std::string_view childName) const {
+        const std::size_t mask = index.size() - 1;
+        for (std::size_t e = hashName(childName) & mask;; e = (e + 1) & mask) {
+            if (index[e] == kEmptyEntry) {
+                return npos;
+            }
+            if (index[e] != kDeletedEntry && children[index[e]]->getName() == childName) {
+                return e;
+            }
+        }
+    }
+
+    void insertEntry(std::uint32_t position) {
+        const std::size_t mask = index.size() - 1;
+        std::size_t e = hashName(children[position]->getName()) & mask;
+        while (index[e] != kEmptyEntry && index[e] != kDeletedEntry) {
+            e = (e + 1) & mask;
+        }
+        indexUsed += (index[e] == kEmptyEntry);
+        index[e] = position;
+    }
+
+    // Rebuilds the index at twice the needed size, or drops it for small directories
+    void rebuildIndex() {
+        index.clear();
+        indexUsed = 0;
+        if (liveChildren <= kIndexThreshold) {
+            index.shrink_to_fit();
+            return;
+        }
+        std::size_t capacity = 1;
+        while (capacity < liveChildren * 4) {
+            capacity <<= 1;
+        }
+        index.assign(capacity, kEmptyEntry);
+        for (std::size_t i = 0; i < children.size(); ++i) {
+            if (children[i]) {
+                insertEntry(static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+
+    // Squeezes out removed slots, keeping the order of the remaining children
+    void compact() {
+        children.erase(std::remove(children.begin(), children.end(), nullptr), children.end());
+        rebuildIndex();
+        recomputeExtensions();
+    }
+
+    // Rebuilds the name index from the direct children; returns true if it changed
+    bool recomputeExtensions() {
+        std::uint64_t bits = 0;
+        forEachLoadedChild([&bits](const FilesystemComponent& c) { bits |= extensionsOf(c); });
+        return extensions.exchange(bits, std::memory_order_relaxed) != bits;
+    }
+
+    // Index bits a child contributes: its own name and, for a directory, everything below
+    static std::uint64_t extensionsOf(const FilesystemComponent& child) {
+        const Directory* dir = child.asDirectory();
+        return nameExtensionBit(child.getName()) |
+               (dir ? dir->extensions.load(std::memory_order_relaxed) : 0);
+    }
+
+    void addExtensions(std::uint64_t bits) {
+        if ((extensions.load(std::memory_order_relaxed) & bits) != bits) {
+            extensions.fetch_or(bits, std::memory_order_relaxed);
+        }
+    }
+
+    // Recomputes depth and deepestChildren from the direct children
+    void recomputeDepth() {
+        depth = 0;
+        deepestChildren = 0;
+        forEachLoadedChild([this](const FilesystemComponent& c) {
+            const std::uint32_t childDepth = c.maxDepth() + 1;
+            if (childDepth > depth) {
+                depth = childDepth;
+                deepestChildren = 1;
+            } else if (childDepth == depth) {
+                ++deepestChildren;
+            }
+        });
+    }
+
+    // Folds a newly added child into this directory and its ancestors. Depth can only
+    // grow here, so the walk stops updating it at the first level that is already deep enough.
+    void propagateAdd(const FilesystemComponent& child) {
+        const std::uint64_t childBytes = child.totalBytes();
+        const std::uint64_t childFiles = child.fileCount();
+        const std::uint64_t childExtensions = extensionsOf(child);
+        std::uint32_t candidateDepth = child.maxDepth() + 1;
+        for (Directory* dir = this; dir != nullptr; dir = dir->parent) {
+            ++dir->subtreeVersion;
+            dir->bytes += childBytes;
+            dir->files += childFiles;
+            dir->addExtensions(childExtensions);
+            if (candidateDepth > dir->depth) {
+                dir->depth = candidateDepth;
+                dir->deepestChildren = 1;
+                candidateDepth = dir->depth + 1;
+            } else {
+                if (candidateDepth != 0 && candidateDepth == dir->depth) {
+                    ++dir->deepestChildren;
+                }
+                candidateDepth = 0;
+            }
+        }
+    }
+
+    // Takes a removed child out of this directory and its ancestors. Depth is recomputed
+    // from the direct children only at levels where the last of the deepest branches left.
+    void propagateRemove(std::uint64_t childBytes, std::uint64_t childFiles, std::uint32_t childDepth) {
+        std::uint32_t removedDepth = childDepth + 1;
+        for (Directory* dir = this; dir != nullptr; dir = dir->parent) {
+            ++dir->subtreeVersion;
+            dir->bytes -= childBytes;
+            dir->files -= childFiles;
+            if (removedDepth != 0 && removedDepth == dir->depth && --dir->deepestChildren == 0) {
+                const std::uint32_t oldDepth = dir->depth;
+                dir->recomputeDepth();
+                removedDepth = dir->depth < oldDepth ? oldDepth + 1 : 0;
+            } else {
+                removedDepth = 0;
+            }
+        }
+    }
+
+    // Walks the path one segment at a time, without copying any part of it
+    std::shared_ptr<FilesystemComponent> walk(std::string_view path) const {
+        const Directory* dir = this;
+        std::shared_ptr<FilesystemComponent> found;
+        const bool complete = forEachPathSegment(path, [&](std::string_view segment) {
+            if (dir == nullptr) {
+                return false; // A file appeared in the middle of the path
+            }
+            Pin pin(dir->lazy.get());
+            dir->ensureLoaded();
+            std::size_t position = dir->findPosition(segment);
+            if (position == npos) {
+                return false;
+            }
+            found = dir->children[position];
+            dir = found->asDirectory();
+            return true;
+        });
+        return complete ? found : nullptr;
+    }
+
+public:
+    explicit Directory(std::string name) : FilesystemComponent(Kind::Directory), name(std::move(name)) {}
+    // Creates a lazy directory: `loader` adds its children the first time they are
+    // needed. With a cache, loaded children may later be evicted and loaded again, so the
+    // loader must produce the same children each time. Subtree totals count loaded
+    // content; an evicted directory keeps the totals it had until it is loaded again.
+    Directory(std::string name, Loader loader, LazyDirectoryCache* cache = nullptr)
+        : FilesystemComponent(Kind::Directory), name(std::move(name)), extensions(~std::uint64_t(0)),
+          lazy(std::make_unique<LazyState>()) {
+        lazy->loader = std::move(loader);
+        lazy->cache = cache;
+        liveLazyDirectories().fetch_add(1, std::memory_order_relaxed);
+    }
+    ~Directory() override;
+    const std::string& getName() const override { return name; }
+    const Directory* asDirectory() const override { return this; }
+    std::uint64_t totalBytes() const override { return bytes; }
+    std::uint64_t fileCount() const override { return files; }
+    std::uint32_t maxDepth() const override { return depth; }
+    // Number of direct children
+    std::size_t childCount() const {
+        Pin pin(lazy.get());
+        ensureLoaded();
+        return liveChildren;
+    }
+    // True unless this is a lazy directory whose children are not in memory
+    bool isLoaded() const { return !lazy || lazy->loaded.load(); }
+    // False only if no name below this directory can have the extension whose
+    // nameExtensionBit is `bit`
+    bool mayContainExtension(std::uint64_t bit) const {
+        return (extensions.load(std::memory_order_relaxed) & bit) != 0;
+    }
+    // Calls fn(const FilesystemComponent&) for each direct child, in insertion order
+    template <typename Fn>
+    void forEachChild(Fn&& fn) const {
+        Pin pin(lazy.get());
+        ensureLoaded();
+        forEachLoadedChild(fn);
+    }
+    // Like forEachChild, but passes each child's shared_ptr, for callers that hold on to
+    // children after the call returns (a lazy ancestor may be unloaded in the meantime)
+    template <typename Fn>
+    void forEachChildShared(Fn&& fn) const {
+        Pin pin(lazy.get());
+        ensureLoaded();
+        for (const auto& child : children) {
+            if (child) {
+                fn(child);
+            }
+        }
+    }
+    // Adds a child component (file or directory); fails if the name is already taken, the
+    // component already belongs to a directory, or it is this directory or an ancestor
+    bool add(const std::shared_ptr<FilesystemComponent>& component) {
+        ensureLoaded();
+        if (!component || component->parent != nullptr ||
+            findPosition(component->getName()) != npos) {
+            return false;
+        }
+        for (const Directory* dir = this; dir != nullptr; dir = dir->parent) {
+            if (dir == component.get()) {
+                return false;
+            }
+        }
+        children.push_back(component);
+        component->parent = this;
+        propagateAdd(*component);
+        ++liveChildren;
+        if (!index.empty() && (indexUsed + 1) * 2 <= index.size()) {
+            insertEntry(static_cast<std::uint32_t>(children.size() - 1));
+        } else if (!index.empty() || liveChildren > kIndexThreshold) {
+            rebuildIndex();
+        }
+        return true;
+    }
+    // Removes a child component; returns false if it is not a child of this directory
+    bool remove(const std::shared_ptr<FilesystemComponent>& component) {
+        if (!component) {
+            return false;
+        }
+        ensureLoaded();
+        std::size_t position = findPosition(component->getName());
+        if (position == npos || children[position] != component) {
+            return false;
+        }
+        return remove(component->getName());
+    }
+    // Removes the child with the given name; returns false if there is none
+    bool remove(std::string_view childName) {
+        ensureLoaded();
+        std::size_t position;
+        if (index.empty()) {
+            position = findPosition(childName);
+        } else {
+            std::size_t entry = findEntry(childName);
+            position = entry == npos ? npos : index[entry];
+            if (entry != npos) {
+                index[entry] = kDeletedEntry;
+            }
+        }
+        if (position == npos) {
+            return false;
+        }
+        const FilesystemComponent& removed = *children[position];
+        const std::uint64_t removedBytes = removed.totalBytes();
+        const std::uint64_t removedFiles = removed.fileCount();
+        const std::uint32_t removedDepth = removed.maxDepth();
+        children[position]->parent = nullptr;
+        children[position].reset();
+        --liveChildren;
+        propagateRemove(removedBytes, removedFiles, removedDepth);
+        if (children.size() > kIndexThreshold && liveChildren * 2 < children.size()) {
+            compact();
+        }
+        return true;
+    }
+    // Preallocates room for the given number of children
+    void reserve(std::size_t childCount) {
+        children.reserve(childCount);
+    }
+    // Returns the child with the given name, or nullptr
+    std::shared_ptr<FilesystemComponent> find(std::string_view childName) const {
+        Pin pin(lazy.get());
+        ensureLoaded();
+        std::size_t position = findPosition(childName);
+        return position == npos ? nullptr : children[position];
+    }
+    // Resolves a slash-separated path relative to this directory, e.g.
+    // "Photos/Presentation.pptx"; returns nullptr if any segment is missing.
+    // Not synchronized: like add/remove it must not race with other calls.
+    std::shared_ptr<FilesystemComponent> resolve(std::string_view path) const {
+        if (pathCacheCapacity == 0) {
+            return walk(path);
+        }
+        if (!pathCache) {
+            pathCache = std::make_unique<PathCache>();
+            pathCache->version = subtreeVersion;
+        }
+        PathCache& cache = *pathCache;
+        if (cache.version != subtreeVersion) {
+            cache.entries.clear();
+            cache.byHash.clear();
+            cache.version = subtreeVersion;
+        }
+        const std::size_t hash = std::hash<std::string_view>()(path);
+        auto hit = cache.byHash.find(hash);
+        if (hit != cache.byHash.end() && hit->second->path == path) {
+            if (std::shared_ptr<FilesystemComponent> target = hit->second->target.lock()) {
+                cache.entries.splice(cache.entries.begin(), cache.entries, hit->second);
+                return target;
+            }
+        }
+        std::shared_ptr<FilesystemComponent> target = walk(path);
+        if (!target) {
+            return nullptr;
+        }
+        if (hit != cache.byHash.end()) {
+            cache.entries.erase(hit->second); // Evict the colliding or expired path
+        } else if (cache.entries.size() >= pathCacheCapacity) {
+            cache.byHash.erase(std::hash<std::string_view>()(cache.entries.back().path));
+            cache.entries.pop_back();
+        }
+        cache.entries.push_front({std::string(path), target});
+        cache.byHash[hash] = cache.entries.begin();
+        return target;
+    }
+    // Sets how many resolved paths are cached; 0 disables the cache
+    void setPathCacheCapacity(std::size_t capacity) {
+        pathCacheCapacity = capacity;
+        pathCache.reset();
+    }
+    // Displays the directory's name and its children with indentation
+    void showDetails(int indent = 0) const override;
+};
+
+// LRU budget for lazy directories that share it. Once their loaded children exceed
+// `maxChildren` in total, the least recently used directories are unloaded. A directory
+// is never evicted while it or one of its descendants is loading (on any thread), or while
+// a reader has it pinned: forEachChild, find, TreeTraversal, parallelReduce and searchTree
+// may therefore run on several threads while loads and evictions happen underneath them.
+// Changing the tree (add, remove) and resolve(), whose path cache is not synchronized,
+// still need exclusive access.
+class LazyDirectoryCache {
+public:
+    explicit LazyDirectoryCache(std::size_t maxChildren) : maxChildren(maxChildren) {}
+    LazyDirectoryCache(const LazyDirectoryCache&) = delete;
+    LazyDirectoryCache& operator=(const LazyDirectoryCache&) = delete;
+
+    // Children currently held in memory by directories using this cache
+    std::size_t loadedChildren() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return used;
+    }
+
+private:
+    friend class Directory;
+    mutable std::mutex mutex;
+    std::mutex evictionMutex;  // One evictor at a time, so a victim's parent is not evicted under it
+    std::list<Directory*> lru; // Most recently used first
+    std::size_t maxChildren;
+    std::size_t used = 0;
+
+    void touch(Directory* dir) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (dir->lazy->inLru) {
+            lru.splice(lru.begin(), lru, dir->lazy->lruPosition);
+        }
+    }
+
+    void forget(Directory* dir) {
+        std::lock_guard<std::mutex> lock(mutex);
+        unlink(dir);
+    }
+
+    void unlink(Directory* dir) {
+        if (dir->lazy->inLru) {
+            lru.erase(dir->lazy->lruPosition);
+            used -= dir->lazy->chargedChildren;
+            dir->lazy->inLru = false;
+        }
+    }
+
+    // Records a freshly loaded directory, then evicts others until the budget fits
+    void loaded(Directory* dir, std::size_t childCount) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            unlink(dir);
+            lru.push_front(dir);
+            dir->lazy->lruPosition = lru.begin();
+            dir->lazy->inLru = true;
+            dir->lazy->chargedChildren = childCount;
+            used += childCount;
+        }
+        // One victim at a time: evicting a directory can destroy others in the list
+        std::lock_guard<std::mutex> evicting(evictionMutex);
+        while (Directory* victim = pickVictim(dir)) {
+            victim->evict();
+            victim->lazy->mutex.unlock();
+            victim->lazy->evicting.store(false, std::memory_order_release);
+        }
+    }
+
+    // True if `candidate` is `loading`, a directory whose loader is running, or an
+    // ancestor of either. Parent pointers are read under the propagation lock.
+    static bool guardsLoad(const Directory* candidate, const Directory* loading) {
+        std::lock_guard<std::mutex> lock(Directory::lazyPropagationMutex());
+        auto isAncestorOf = [candidate](const Directory* dir) {
+            for (const Directory* d = dir; d != nullptr; d = d->getParent()) {
+                if (d == candidate) {
+                    return true;
+                }
+            }
+            return false;
+        };
+        if (isAncestorOf(loading)) {
+            return true;
+        }
+        for (const Directory* inFlight : Directory::loadsInFlight()) {
+            if (isAncestorOf(inFlight)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns the least recently used evictable directory with its mutex locked, or nullptr
+    Directory* pickVictim(const Directory* loading) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = lru.rbegin(); used > maxChildren && it != lru.rend(); ++it) {
+            Directory* candidate = *it;
+            if (candidate->lazy->pins.load() != 0 || guardsLoad(candidate, loading) ||
+                !candidate->lazy->mutex.try_lock()) {
+                continue;
+            }
+            // Mark it unloaded first, then re-check for a reader that pinned it meanwhile
+            candidate->lazy->loaded.store(false);
+            if (candidate->lazy->pins.load() != 0) {
+                candidate->lazy->loaded.store(true);
+                candidate->lazy->mutex.unlock();
+                continue;
+            }
+            unlink(candidate);
+            candidate->lazy->evicting.store(true, std::memory_order_relaxed);
+            return candidate;
+        }
+        return nullptr;
+    }
+};
+
+Directory::~Directory() {
+    if (lazy && lazy->cache) {
+        lazy->cache->forget(this);
+        // The last owner can be a traversal on another thread while an evictor that picked
+        // this directory before forget() is still unloading it; wait for that to finish
+        while (lazy->evicting.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    if (lazy) {
+        liveLazyDirectories().fetch_sub(1, std::memory_order_relaxed);
+    }
+    // Tear the subtree down with an explicit stack: letting each directory destroy its
+    // children in turn would nest one destructor call per level and overflow on deep trees.
+    // The outermost ~Directory on a thread drains the stack; directories destroyed while it
+    // runs only hand their children over to it.
+    static thread_local std::vector<std::shared_ptr<FilesystemComponent>>* teardown = nullptr;
+    {
+        // A load or eviction below this directory may be walking up through it on another
+        // thread; detaching under the propagation lock keeps this directory alive until
+        // that walk has passed
+        std::unique_lock<std::mutex> lock(lazyPropagationMutex(), std::defer_lock);
+        if (liveLazyDirectories().load(std::memory_order_relaxed) != 0) {
+            lock.lock();
+        }
+        for (auto& child : children) {
+            if (child) {
+                child->parent = nullptr;
+            }
+        }
+    }
+    if (teardown != nullptr) {
+        std::move(children.begin(), children.end(), std::back_inserter(*teardown));
+        return;
+    }
+    std::vector<std::shared_ptr<FilesystemComponent>> doomed;
+    doomed.swap(children);
+    teardown = &doomed;
+    while (!doomed.empty()) {
+        std::shared_ptr<FilesystemComponent> node = std::move(doomed.back());
+        doomed.pop_back();
+        node.reset(); // May run ~Directory, which appends to `doomed`
+    }
+    teardown = nullptr;
+}
+
+void Directory::ensureLoaded() const {
+    if (!lazy) {
+        return;
+    }
+    Directory* self = const_cast<Directory*>(this);
+    if (lazy->loaded.load()) {
+        if (lazy->cache) {
+            lazy->cache->touch(self);
+        }
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> lock(lazy->mutex);
+    if (!lazy->loaded.load() && !lazy->loading) {
+        self->load();
+    }
+}
+
+void Directory::load() {
+    // The loader fills a staging directory, so this directory's children and totals only
+    // change below, in one short step under the same lock as every other ancestor update.
+    // While it runs, the directory is listed as in flight so no evictor frees an ancestor.
+    struct InFlight {
+        Directory* dir;
+        explicit InFlight(Directory* dir) : dir(dir) {
+            std::lock_guard<std::mutex> lock(lazyPropagationMutex());
+            loadsInFlight().push_back(dir);
+            dir->lazy->loading = true;
+        }
+        ~InFlight() {
+            std::lock_guard<std::mutex> lock(lazyPropagationMutex());
+            auto& loads = loadsInFlight();
+            loads.erase(std::find(loads.begin(), loads.end(), dir));
+            dir->lazy->loading = false;
+        }
+    };
+    Directory staging(name);
+    {
+        InFlight inFlight(this);
+        lazy->loader(staging);
+    }
+    {
+        std::lock_guard<std::mutex> lock(lazyPropagationMutex());
+        const std::uint64_t oldBytes = bytes;
+        const std::uint64_t oldFiles = files;
+        const std::uint32_t oldDepth = depth;
+        children = std::move(staging.children);
+        staging.children.clear();
+        index = std::move(staging.index);
+        indexUsed = staging.indexUsed;
+        liveChildren = staging.liveChildren;
+        for (auto& child : children) {
+            if (child) {
+                child->parent = this;
+            }
+        }
+        bytes = staging.bytes;
+        files = staging.files;
+        depth = staging.depth;
+        deepestChildren = staging.deepestChildren;
+        const std::uint64_t newExtensions = staging.extensions.load(std::memory_order_relaxed);
+        bool extensionsChanged = extensions.exchange(newExtensions, std::memory_order_relaxed) != newExtensions;
+        ++subtreeVersion;
+        bool depthChanged = depth != oldDepth;
+        for (Directory* dir = parent; dir != nullptr; dir = dir->parent) {
+            ++dir->subtreeVersion;
+            if (extensionsChanged) {
+                extensionsChanged = dir->recomputeExtensions();
+            }
+            dir->bytes = dir->bytes - oldBytes + bytes;
+            dir->files = dir->files - oldFiles + files;
+            if (depthChanged) {
+                const std::uint32_t previous = dir->depth;
+                dir->recomputeDepth();
+                depthChanged = dir->depth != previous;
+            }
+        }
+    }
+    lazy->loaded.store(true);
+    if (lazy->cache) {
+        lazy->cache->loaded(this, liveChildren);
+    }
+}
+
+void Directory::evict() {
+    // Dropped children are released after the lock: destroying them may reach the cache
+    std::vector<std::shared_ptr<FilesystemComponent>> dropped;
+    std::lock_guard<std::mutex> lock(lazyPropagationMutex());
+    dropped.swap(children);
+    for (auto& child : dropped) {
+        if (child) {
+            child->parent = nullptr; // A load below reads parent under the same lock
+        }
+    }
+    liveChildren = 0;
+    index.clear();
+    index.shrink_to_fit();
+    indexUsed = 0;
+    for (Directory* dir = this; dir != nullptr; dir = dir->parent) {
+        ++dir->subtreeVersion; // Drops cached resolve() results that point into the subtree
+    }
+}
+
+// Scratch space for TreeTraversal: the explicit stack (or queue, for breadth-first order)
+// that stands in for the call stack. Passing the same TraversalStack to successive
+// traversals reuses its allocation; it must not be shared by two traversals at once.
+class TraversalStack {
+public:
+    // Entries the stack and queue can hold without reallocating
+    std::size_t capacity() const { return frames.capacity() + queue.capacity(); }
+
+private:
+    friend class TreeTraversal;
+    struct Frame {
+        const FilesystemComponent* node;
+        const Directory* dir;   // node->asDirectory(), looked up once
+        std::size_t depth;
+        std::size_t nextSlot;   // Depth-first: next child slot of dir to descend into
+    };
+    std::vector<Frame> frames;
+    // Breadth-first queue. Queued nodes are held by owning pointer: their lazy ancestors
+    // may be unloaded before the queue reaches them.
+    struct Queued {
+        std::shared_ptr<FilesystemComponent> owner; // Empty for the root, which the caller holds
+        const FilesystemComponent* node;
+        std::size_t depth;
+    };
+    std::vector<Queued> queue;
+    std::size_t head = 0;
+
+    void clear() {
+        frames.clear();
+        queue.clear();
+        head = 0;
+    }
+};
+
+// Iterative traversal of a FilesystemComponent tree in pre-order (directories before their
+// children), post-order (children before their directory) or breadth-first order. The
+// position is kept in a TraversalStack instead of on the call stack, so trees of any depth
+// can be walked, and results are pulled through an input iterator rather than pushed
+// through a callback:
+//
+//     for (const auto& entry : TreeTraversal(root, TreeTraversal::Order::PostOrder)) ...
+//
+// Lazy directories are loaded as the traversal reaches them and kept loaded while it still
+// needs their children. The tree must not be modified during a traversal.
+class TreeTraversal {
+public:
+    enum class Order { PreOrder, PostOrder, BreadthFirst };
+
+    struct Entry {
+        const FilesystemComponent* node;
+        std::size_t depth; // 0 for the root
+    };
+
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+
+        Iterator() = default;
+        const Entry& operator*() const { return traversal->current; }
+        const Entry* operator->() const { return &traversal->current; }
+        Iterator& operator++() {
+            if (!traversal->advance()) {
+                traversal = nullptr;
+            }
+            return *this;
+        }
+        // The traversal is shared, so the previous position survives only as a copied entry
+        struct Previous {
+            Entry entry;
+            const Entry& operator*() const { return entry; }
+            const Entry* operator->() const { return &entry; }
+        };
+        Previous operator++(int) {
+            Previous previous{traversal->current};
+            ++*this;
+            return previous;
+        }
+        bool operator==(const Iterator& other) const { return traversal == other.traversal; }
+        bool operator!=(const Iterator& other) const { return traversal != other.traversal; }
+
+    private:
+        friend class TreeTraversal;
+        explicit Iterator(TreeTraversal* traversal) : traversal(traversal) {}
+        TreeTraversal* traversal = nullptr;
+    };
+
+    // Traverses with a private stack
+    TreeTraversal(const FilesystemComponent& root, Order order)
+        : root(root), order(order), stack(ownStack) {}
+    // Traverses with a caller-provided stack, reusing whatever it has already allocated
+    TreeTraversal(const FilesystemComponent& root, Order order, TraversalStack& stack)
+        : root(root), order(order), stack(stack) {}
+    TreeTraversal(const TreeTraversal&) = delete;
+    TreeTraversal& operator=(const TreeTraversal&) = delete;
+    ~TreeTraversal() { release(); }
+
+    // Starts (or restarts) the traversal at the root
+    Iterator begin() {
+        release();
+        if (order == Order::BreadthFirst) {
+            stack.queue.push_back({nullptr, &root, 0});
+        } else {
+            push(root, 0);
+            if (order == Order::PreOrder) {
+                current = {&root, 0};
+                return Iterator(this);
+            }
+        }
+        return advance() ? Iterator(this) : end();
+    }
+    Iterator end() { return Iterator(); }
+
+private:
+    using Frame = TraversalStack::Frame;
+
+    const FilesystemComponent& root;
+    Order order;
+    TraversalStack ownStack;
+    TraversalStack& stack;
+    Entry current{nullptr, 0};
+    std::shared_ptr<FilesystemComponent> currentOwner; // Breadth-first: keeps `current` alive
+
+    // Depth-first frames pin their directory until they are popped
+    void push(const FilesystemComponent& node, std::size_t depth) {
+        Frame frame{&node, node.asDirectory(), depth, 0};
+        if (frame.dir != nullptr) {
+            frame.dir->pinTraversal();
+        }
+        stack.frames.push_back(frame);
+    }
+
+    void pop() {
+        if (stack.frames.back().dir != nullptr) {
+            stack.frames.back().dir->unpinTraversal();
+        }
+        stack.frames.pop_back();
+    }
+
+    // Returns the next unvisited child of the top frame and moves past it, or nullptr
+    const FilesystemComponent* nextChild() {
+        Frame& top = stack.frames.back();
+        if (top.dir == nullptr) {
+            return nullptr;
+        }
+        const std::size_t slot = top.dir->nextLiveSlot(top.nextSlot);
+        if (slot == top.dir->children.size()) {
+            return nullptr;
+        }
+        top.nextSlot = slot + 1;
+        return top.dir->children[slot].get();
+    }
+
+    // Moves `current` to the next node; returns false once the traversal is finished
+    bool advance() {
+        switch (order) {
+        case Order::PreOrder:
+            while (!stack.frames.empty()) {
+                if (const FilesystemComponent* child = nextChild()) {
+                    const std::size_t depth = stack.frames.back().depth + 1;
+                    push(*child, depth);
+                    current = {child, depth};
+                    return true;
+                }
+                pop();
+            }
+            return false;
+        case Order::PostOrder:
+            while (!stack.frames.empty()) {
+                if (const FilesystemComponent* child = nextChild()) {
+                    push(*child, stack.frames.back().depth + 1);
+                    continue;
+                }
+                current = {stack.frames.back().node, stack.frames.back().depth};
+                pop();
+                return true;
+            }
+            return false;
+        case Order::BreadthFirst:
+            return advanceBreadthFirst();
+        }
+        return false;
+    }
+
+    bool advanceBreadthFirst() {
+        std::vector<TraversalStack::Queued>& queue = stack.queue;
+        if (stack.head == queue.size()) {
+            release();
+            return false;
+        }
+        TraversalStack::Queued& front = queue[stack.head++];
+        currentOwner = std::move(front.owner);
+        current = {front.node, front.depth};
+        if (const Directory* dir = current.node->asDirectory()) {
+            dir->forEachChildShared([&](const std::shared_ptr<FilesystemComponent>& child) {
+                queue.push_back({child, child.get(), current.depth + 1});
+            });
+        }
+        // Drop the consumed front once it outweighs the live part of the queue
+        if (stack.head >= 1024 && stack.head * 2 >= queue.size()) {
+            queue.erase(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(stack.head));
+            stack.head = 0;
+        }
+        return true;
+    }
+
+    // Drops the pins of an unfinished traversal and empties the stack
+    void release() {
+        while (!stack.frames.empty()) {
+            pop();
+        }
+        stack.clear();
+        currentOwner.reset();
+    }
+};
+
+// Output for the tree printers: text goes into a reusable buffer that is written out in
+// large chunks, instead of being formatted and flushed one line at a time, and indentation
+// is copied from one shared run of spaces
+class ChunkedOutput {
+public:
+    explicit ChunkedOutput(std::ostream& out, std::size_t chunkSize = 64 * 1024)
+        : out(out), chunkSize(chunkSize) {
+        buffer.reserve(chunkSize + 4096);
+    }
+
+    // Appends one line in the showDetails format, e.g. "  Directory: Photos"
+    void appendDetailsLine(std::size_t indent, bool isDirectory, std::string_view name) {
+        appendIndent(indent);
+        buffer.append(isDirectory ? "Directory: " : "File: ");
+        buffer.append(name);
+        buffer.push_back('\n');
+        writeIfFull();
+    }
+
+    // Writes out whatever is buffered and flushes the stream once
+    void flush() {
+        writeBuffer();
+        out.flush();
+    }
+
+private:
+    friend class TreeRenderer;
+
+    std::ostream& out;
+    std::size_t chunkSize;
+    std::string buffer;
+    std::string spaces;
+
+    void writeBuffer() {
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+
+    void writeIfFull() {
+        if (buffer.size() >= chunkSize) {
+            writeBuffer();
+        }
+    }
+
+    void appendIndent(std::size_t count) {
+        if (spaces.size() < count) {
+            spaces.assign(std::max(count, spaces.size() * 2), ' ');
+        }
+        buffer.append(spaces.data(), count);
+    }
+};
+
+// The showDetails output to std::cout for this thread. Every tree representation prints
+// through it, so lines from interleaved showDetails calls reach the stream in call order.
+inline ChunkedOutput& detailsOutput() {
+    static thread_local ChunkedOutput output(std::cout);
+    return output;
+}
+
+// Renders a tree through a ChunkedOutput, its own or a shared one. Keep a renderer around
+// to reuse its buffer across calls.
+class TreeRenderer {
+public:
+    enum class Format { Text, Json };
+
+    explicit TreeRenderer(std::ostream& out, std::size_t chunkSize = 64 * 1024)
+        : owned(std::make_unique<ChunkedOutput>(out, chunkSize)), output(*owned) {}
+    // Renders into an output shared with other printers, such as detailsOutput()
+    explicit TreeRenderer(ChunkedOutput& shared) : output(shared) {}
+
+    // Writes the tree rooted at `root`, then flushes the stream once
+    void render(const FilesystemComponent& root, Format format = Format::Text, int indent = 0) {
+        if (format == Format::Text) {
+            renderText(root, indent);
+        } else {
+            renderJson(root);
+            output.buffer.push_back('\n');
+        }
+        output.flush();
+    }
+
+private:
+    std::unique_ptr<ChunkedOutput> owned;
+    ChunkedOutput& output;
+    TraversalStack stack;
+
+    void appendJsonString(std::string_view text) {
+        static const char hex[] = "0123456789abcdef";
+        output.buffer.push_back('"');
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                output.buffer.push_back('\\');
+                output.buffer.push_back(c);
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                output.buffer.append("\\u00");
+                output.buffer.push_back(hex[(c >> 4) & 0xF]);
+                output.buffer.push_back(hex[c & 0xF]);
+            } else {
+                output.buffer.push_back(c);
+            }
+        }
+        output.buffer.push_back('"');
+    }
+
+    void renderText(const FilesystemComponent& root, int indent) {
+        for (const TreeTraversal::Entry& entry : TreeTraversal(root, TreeTraversal::Order::PreOrder, stack)) {
+            output.appendDetailsLine(static_cast<std::size_t>(indent) + 2 * entry.depth,
+                                     entry.node->asDirectory() != nullptr, entry.node->getName());
+        }
+    }
+
+    // Directories stay open until an entry at their own depth or above arrives, so the
+    // closing brackets are emitted from the pre-order sequence without recursion
+    void renderJson(const FilesystemComponent& root) {
+        std::size_t open = 0;
+        bool afterValue = false;
+        for (const TreeTraversal::Entry& entry : TreeTraversal(root, TreeTraversal::Order::PreOrder, stack)) {
+            for (; open > entry.depth; --open) {
+                output.buffer.append("]}");
+                afterValue = true;
+            }
+            if (afterValue) {
+                output.buffer.push_back(',');
+            }
+            output.buffer.append("{\"name\":");
+            appendJsonString(entry.node->getName());
+            if (entry.node->asDirectory() == nullptr) {
+                output.buffer.append(",\"type\":\"file\",\"size\":");
+                output.buffer.append(std::to_string(entry.node->totalBytes()));
+                output.buffer.push_back('}');
+                afterValue = true;
+            } else {
+                output.buffer.append(",\"type\":\"directory\",\"children\":[");
+                open = entry.depth + 1;
+                afterValue = false;
+            }
+            output.writeIfFull();
+        }
+        for (; open > 0; --open) {
+            output.buffer.append("]}");
+        }
+    }
+};
+
+void File::showDetails(int indent) const {
+    static thread_local TreeRenderer renderer(detailsOutput());
+    renderer.render(*this, TreeRenderer::Format::Text, indent);
+}
+
+void Directory::showDetails(int indent) const {
+    static thread_local TreeRenderer renderer(detailsOutput());
+    renderer.render(*this, TreeRenderer::Format::Text, indent);
+}
+
+// Compact Composite: FlatFilesystem
+// Every file and directory is a 32-byte Node in one vector; links are 32-bit indices, so
+// a tree costs one allocation for the nodes and one for the names instead of one per node.
+// File sizes live in a parallel column, indexed by the same NodeId.
+class FlatFilesystem {
+public:
+    using NodeId = std::uint32_t;
+    static constexpr NodeId npos = 0xFFFFFFFFu;
+    enum class Kind : std::uint8_t { File, Directory };
+
+private:
+    struct Node {
+        std::uint32_t nameOffset;  // Start of the name inside the shared blob
+        std::uint32_t nameLength;
+        NodeId parent;
+        NodeId firstChild;
+        NodeId lastChild;          // Lets add() append in O(1) and keep insertion order
+        NodeId prevSibling;        // Lets remove() unlink in O(1)
+        NodeId nextSibling;
+        Kind kind;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<std::uint64_t> sizes; // 0 for directories
+    std::string names;
+    friend MemoryReport measureMemory(const FlatFilesystem& fs);
+
+    // Returns npos once the arena is full: ids must stay below npos, and every name must
+    // end within the 32-bit offset range
+    NodeId createNode(std::string_view name, Kind kind, std::uint64_t size) {
+        if (nodes.size() >= npos || names.size() > 0xFFFFFFFFu - name.size()) {
+            return npos;
+        }
+        Node node;
+        node.nameOffset = static_cast<std::uint32_t>(names.size());
+        node.nameLength = static_cast<std::uint32_t>(name.size());
+        node.parent = node.firstChild = node.lastChild = npos;
+        node.prevSibling = node.nextSibling = npos;
+        node.kind = kind;
+        names.append(name.data(), name.size());
+        nodes.push_back(node);
+        sizes.push_back(size);
+        return static_cast<NodeId>(nodes.size() - 1);
+    }
+
+public:
+    // Reserves arena space up front when the final tree size is known
+    void reserve(std::size_t nodeCount, std::size_t nameBytes) {
+        nodes.reserve(nodeCount);
+        sizes.reserve(nodeCount);
+        names.reserve(nameBytes);
+    }
+
+    // Creates an unattached leaf or composite; attach it with add(). Returns npos if the
+    // arena has no room left
+    NodeId createFile(std::string_view name, std::uint64_t size = 0) { return createNode(name, Kind::File, size); }
+    NodeId createDirectory(std::string_view name) { return createNode(name, Kind::Directory, 0); }
+
+    std::string_view name(NodeId id) const {
+        return std::string_view(names.data() + nodes[id].nameOffset, nodes[id].nameLength);
+    }
+    Kind kind(NodeId id) const { return nodes[id].kind; }
+    std::uint64_t fileSize(NodeId id) const { return sizes[id]; }
+    NodeId parent(NodeId id) const { return nodes[id].parent; }
+    NodeId firstChild(NodeId id) const { return nodes[id].firstChild; }
+    NodeId nextSibling(NodeId id) const { return nodes[id].nextSibling; }
+    std::size_t size() const { return nodes.size(); }
+
+    // Adds a child component (file or directory) to the end of a directory; fails if either
+    // id is invalid, the child already has a parent, or it is the directory or an ancestor
+    bool add(NodeId directory, NodeId child) {
+        if (directory >= nodes.size() || child >= nodes.size()) {
+            return false;
+        }
+        if (nodes[directory].kind != Kind::Directory || nodes[child].parent != npos) {
+            return false; // Only directories have children, and a node has a single parent
+        }
+        for (NodeId ancestor = directory; ancestor != npos; ancestor = nodes[ancestor].parent) {
+            if (ancestor == child) {
+                return false; // A directory cannot be added below itself
+            }
+        }
+        Node& dir = nodes[directory];
+        Node& node = nodes[child];
+        node.parent = directory;
+        node.prevSibling = dir.lastChild;
+        node.nextSibling = npos;
+        if (dir.lastChild != npos) {
+            nodes[dir.lastChild].nextSibling = child;
+        } else {
+            dir.firstChild = child;
+        }
+        dir.lastChild = child;
+        return true;
+    }
+
+    // Removes a child component from a directory; returns false if it is not a child of
+    // it. The unlinked subtree stays in the arena and can be re-added elsewhere; its
+    // storage is reclaimed with the arena.
+    bool remove(NodeId directory, NodeId child) {
+        if (directory >= nodes.size() || child >= nodes.size() || nodes[child].parent != directory) {
+            return false;
+        }
+        Node& node = nodes[child];
+        Node& dir = nodes[directory];
+        if (node.prevSibling != npos) nodes[node.prevSibling].nextSibling = node.nextSibling;
+        else dir.firstChild = node.nextSibling;
+        if (node.nextSibling != npos) nodes[node.nextSibling].prevSibling = node.prevSibling;
+        else dir.lastChild = node.prevSibling;
+        node.parent = node.prevSibling = node.nextSibling = npos;
+        return true;
+    }
+
+    // Displays a node and its descendants with indentation, in the same format as
+    // FilesystemComponent::showDetails. Walks the sibling/parent links, so no recursion.
+    void showDetails(NodeId root, int indent = 0) const {
+        ChunkedOutput& output = detailsOutput();
+        NodeId current = root;
+        std::size_t depth = 0;
+        while (current != npos) {
+            const Node& node = nodes[current];
+            output.appendDetailsLine(static_cast<std::size_t>(indent) + 2 * depth, node.kind == Kind::Directory,
+                                     name(current));
+            if (node.firstChild != npos) {
+                current = node.firstChild;
+                ++depth;
+                continue;
+            }
+            // Climb until a node with an unvisited sibling is found, stopping at root
+            while (current != root && nodes[current].nextSibling == npos) {
+                current = nodes[current].parent;
+                --depth;
+            }
+            current = (current == root) ? npos : nodes[current].nextSibling;
+        }
+        output.flush();
+    }
+};
+
+// Batched visitors
+// visitBatched runs an operation over a tree without a new virtual method on
+// FilesystemComponent. The walk sorts nodes by kind into a batch of files and a batch of
+// directories (using the kind tag, not a virtual call), and each full batch is handed to
+// the visitor in one tight loop of ordinary, inlinable calls:
+//
+//     struct Visitor {
+//         void visit(const FileView& file);
+//         void visit(const DirectoryView& directory);
+//     };
+//
+// The same visitor runs on a Directory tree or on a FlatFilesystem. Files and directories
+// arrive as separate groups, so a visitor must not depend on their relative order.
+struct FileView {
+    std::string_view name;
+    std::uint64_t size;
+};
+
+struct DirectoryView {
+    std::string_view name;
+};
+
+// Nodes gathered per kind before a batch is dispatched; small enough to stay in cache
+constexpr std::size_t kVisitBatchSize = 1024;
+
+// Visits the tree rooted at `root`. Lazy directories are loaded as the walk reaches them,
+// but batches hold plain pointers: the tree must not change during the visit, which
+// includes a LazyDirectoryCache unloading part of it to make room.
+template <typename Visitor>
+void visitBatched(const FilesystemComponent& root, Visitor& visitor) {
+    using Kind = FilesystemComponent::Kind;
+    std::vector<const File*> files;
+    std::vector<const Directory*> directories;
+    std::vector<const Directory*> pending;
+    files.reserve(kVisitBatchSize);
+    directories.reserve(kVisitBatchSize);
+    auto flushFiles = [&] {
+        for (const File* file : files) {
+            visitor.visit(FileView{file->getName(), file->getSize()});
+        }
+        files.clear();
+    };
+    auto flushDirectories = [&] {
+        for (const Directory* dir : directories) {
+            visitor.visit(DirectoryView{dir->getName()});
+        }
+        directories.clear();
+    };
+
+    if (root.kind() == Kind::File) {
+        files.push_back(static_cast<const File*>(&root));
+    } else {
+        pending.push_back(static_cast<const Directory*>(&root));
+    }
+    while (!pending.empty()) {
+        const Directory* dir = pending.back();
+        pending.pop_back();
+        directories.push_back(dir);
+        dir->forEachChild([&](const FilesystemComponent& child) {
+            if (child.kind() == Kind::File) {
+                files.push_back(static_cast<const File*>(&child));
+                if (files.size() == kVisitBatchSize) {
+                    flushFiles();
+                }
+            } else {
+                pending.push_back(static_cast<const Directory*>(&child));
+            }
+        });
+        if (directories.size() == kVisitBatchSize) {
+            flushDirectories();
+        }
+    }
+    flushFiles();
+    flushDirectories();
+}
+
+// Visits the subtree of a FlatFilesystem rooted at `root`, batching node ids by kind
+template <typename Visitor>
+void visitBatched(const FlatFilesystem& fs, FlatFilesystem::NodeId root, Visitor& visitor) {
+    using NodeId = FlatFilesystem::NodeId;
+    std::vector<NodeId> files;
+    std::vector<NodeId> directories;
+    std::vector<NodeId> pending;
+    files.reserve(kVisitBatchSize);
+    directories.reserve(kVisitBatchSize);
+    auto flushFiles = [&] {
+        for (NodeId id : files) {
+            visitor.visit(FileView{fs.name(id), fs.fileSize(id)});
+        }
+        files.clear();
+    };
+    auto flushDirectories = [&] {
+        for (NodeId id : directories) {
+            visitor.visit(DirectoryView{fs.name(id)});
+        }
+        directories.clear();
+    };
+
+    if (fs.kind(root) == FlatFilesystem::Kind::File) {
+        files.push_back(root);
+    } else {
+        pending.push_back(root);
+    }
+    while (!pending.empty()) {
+        const NodeId dir = pending.back();
+        pending.pop_back();
+        directories.push_back(dir);
+        for (NodeId child = fs.firstChild(dir); child != FlatFilesystem::npos; child = fs.nextSibling(child)) {
+            if (fs.kind(child) == FlatFilesystem::Kind::File) {
+                files.push_back(child);
+                if (files.size() == kVisitBatchSize) {
+                    flushFiles();
+                }
+            } else {
+                pending.push_back(child);
+            }
+        }
+        if (directories.size() == kVisitBatchSize) {
+            flushDirectories();
+        }
+    }
+    flushFiles();
+    flushDirectories();
+}
+
+// Example visitor: file and directory counts, total bytes and the largest file
+struct SizeSummary {
+    std::uint64_t files = 0;
+    std::uint64_t directories = 0;
+    std::uint64_t bytes = 0;
+    std::string largest;
+    std::uint64_t largestSize = 0;
+
+    void visit(const FileView& file) {
+        ++files;
+        bytes += file.size;
+        if (file.size > largestSize || largest.empty()) {
+            largestSize = file.size;
+            largest.assign(file.name);
+        }
+    }
+    void visit(const DirectoryView&) { ++directories; }
+};
+
+// Bytes held by a tree, split by what they are spent on. Figures come from sizeof and
+// container capacities; allocator bookkeeping (malloc headers, size-class rounding) is not
+// included, and shared_ptr control blocks are assumed to come from std::make_shared.
+struct MemoryReport {
+    std::uint64_t files = 0;
+    std::uint64_t directories = 0;
+    std::uint64_t nodeObjects = 0;    // The File/Directory (or flat Node) objects themselves
+    std::uint64_t controlBlocks = 0;  // shared_ptr reference counts allocated beside each node
+    std::uint64_t nameHeap = 0;       // Name characters stored outside the string objects
+    std::uint64_t childArrays = 0;    // Child pointers in use
+    std::uint64_t containerSlack = 0; // Reserved but unused capacity, including removed slots
+    std::uint64_t indexes = 0;        // Name lookup tables of large directories
+    std::uint64_t auxiliary = 0;      // Lazy-loading state and resolve() caches
+
+    std::uint64_t total() const {
+        return nodeObjects + controlBlocks + nameHeap + childArrays + containerSlack + indexes + auxiliary;
+    }
+
+    void print(std::ostream& out) const {
+        const std::uint64_t nodes = std::max<std::uint64_t>(1, files + directories);
+        out << total() << " bytes for " << files << " files and " << directories
+            << " directories (" << total() / nodes << " bytes per node)\n"
+            << "  node objects     " << nodeObjects << '\n'
+            << "  control blocks   " << controlBlocks << '\n'
+            << "  name heap        " << nameHeap << '\n'
+            << "  child arrays     " << childArrays << '\n'
+            << "  container slack  " << containerSlack << '\n'
+            << "  indexes          " << indexes << '\n'
+            << "  auxiliary        " << auxiliary << '\n';
+    }
+};
+
+// Heap bytes behind a string: none while the characters fit in the object itself
+inline std::uint64_t stringHeapBytes(const std::string& text) {
+    const char* object = reinterpret_cast<const char*>(&text);
+    const bool isInline = text.data() >= object && text.data() < object + sizeof(text);
+    return isInline ? 0 : text.capacity() + 1;
+}
+
+// Measures the part of the tree rooted at `root` that is in memory; children of unloaded
+// lazy directories are not loaded for it. The tree must not change while it is measured.
+MemoryReport measureMemory(const FilesystemComponent& root) {
+#if defined(__GLIBCXX__)
+    constexpr std::uint64_t controlBlockBytes = sizeof(void*) + 2 * sizeof(int);  // vptr, use and weak counts
+#else
+    constexpr std::uint64_t controlBlockBytes = sizeof(void*) + 2 * sizeof(long);
+#endif
+    constexpr std::uint64_t pointerBytes = sizeof(std::shared_ptr<FilesystemComponent>);
+    MemoryReport report;
+    std::vector<const FilesystemComponent*> pending{&root};
+    while (!pending.empty()) {
+        const FilesystemComponent* node = pending.back();
+        pending.pop_back();
+        report.controlBlocks += controlBlockBytes;
+        report.nameHeap += stringHeapBytes(node->getName());
+        if (node->kind() == FilesystemComponent::Kind::File) {
+            ++report.files;
+            report.nodeObjects += sizeof(File);
+            continue;
+        }
+        const Directory& dir = static_cast<const Directory&>(*node);
+        ++report.directories;
+        report.nodeObjects += sizeof(Directory);
+        report.childArrays += dir.liveChildren * pointerBytes;
+        report.containerSlack += (dir.children.capacity() - dir.liveChildren) * pointerBytes;
+        report.indexes += dir.index.capacity() * sizeof(std::uint32_t);
+        if (dir.lazy) {
+            report.auxiliary += sizeof(Directory::LazyState);
+        }
+        if (dir.pathCache) {
+            const Directory::PathCache& cache = *dir.pathCache;
+            report.auxiliary += sizeof(Directory::PathCache) + cache.byHash.bucket_count() * sizeof(void*);
+            for (const auto& entry : cache.entries) {
+                // A list node (entry plus two links) and a hash map node (key, iterator, link)
+                report.auxiliary += sizeof(entry) + 2 * sizeof(void*) + stringHeapBytes(entry.path) +
+                                    sizeof(*cache.byHash.begin()) + sizeof(void*);
+            }
+        }
+        dir.forEachLoadedChild([&pending](const FilesystemComponent& child) { pending.push_back(&child); });
+    }
+    return report;
+}
+
+// Measures a whole FlatFilesystem arena, including nodes that are not attached to any tree
+MemoryReport measureMemory(const FlatFilesystem& fs) {
+    MemoryReport report;
+    for (const FlatFilesystem::Node& node : fs.nodes) {
+        ++(node.kind == FlatFilesystem::Kind::File ? report.files : report.directories);
+    }
+    report.nodeObjects = fs.nodes.size() * sizeof(FlatFilesystem::Node) + fs.sizes.size() * sizeof(std::uint64_t);
+    report.nameHeap = fs.names.size();
+    report.containerSlack = (fs.nodes.capacity() - fs.nodes.size()) * sizeof(FlatFilesystem::Node) +
+                            (fs.sizes.capacity() - fs.sizes.size()) * sizeof(std::uint64_t) +
+                            (stringHeapBytes(fs.names) == 0 ? 0 : fs.names.capacity() + 1 - fs.names.size());
+    return report;
+}
+
+// Persistent Composite: PersistentNode
+// An immutable file or directory that can be shared by many versions of a tree. Changing
+// a tree never modifies a node: PersistentFilesystem copies the directories on the path
+// to the change and reuses every other subtree as is. Children are kept sorted by name,
+// and totals are computed once, when a node is built.
+class PersistentNode {
+private:
+    struct Token {
+        explicit Token() = default;
+    };
+
+public:
+    using Ptr = std::shared_ptr<const PersistentNode>;
+
+    PersistentNode(Token, std::string name, bool directory, std::uint64_t size, std::vector<Ptr> children)
+        : name(std::move(name)), isDir(directory), children(std::move(children)) {
+        bytes = size;
+        files = directory ? 0 : 1;
+        for (const Ptr& child : this->children) {
+            bytes += child->bytes;
+            files += child->files;
+            depth = std::max(depth, child->depth + 1);
+        }
+    }
+    PersistentNode(const PersistentNode&) = delete;
+    PersistentNode& operator=(const PersistentNode&) = delete;
+    ~PersistentNode();
+
+    static Ptr file(std::string name, std::uint64_t size = 0) {
+        return std::make_shared<const PersistentNode>(Token{}, std::move(name), false, size, std::vector<Ptr>());
+    }
+    static Ptr directory(std::string name) {
+        return std::make_shared<const PersistentNode>(Token{}, std::move(name), true, 0, std::vector<Ptr>());
+    }
+    // Snapshots an existing tree, building each directory after its children
+    static Ptr copyOf(const FilesystemComponent& root);
+
+    const std::string& getName() const { return name; }
+    bool isDirectory() const { return isDir; }
+    std::uint64_t totalBytes() const { return bytes; }
+    std::uint64_t fileCount() const { return files; }
+    std::uint32_t maxDepth() const { return depth; }
+    // Direct children, sorted by name
+    const std::vector<Ptr>& getChildren() const { return children; }
+
+    // Returns the child with the given name, or nullptr
+    Ptr find(std::string_view childName) const {
+        auto it = lowerBound(childName);
+        return it != children.end() && (*it)->name == childName ? *it : nullptr;
+    }
+
+    // Resolves a slash-separated path relative to this node, like Directory::resolve
+    Ptr resolve(std::string_view path) const {
+        const PersistentNode* current = this;
+        Ptr found;
+        const bool complete = forEachPathSegment(path, [&](std::string_view segment) {
+            if (current == nullptr || !(found = current->find(segment))) {
+                return false;
+            }
+            current = found.get();
+            return true;
+        });
+        return complete ? found : nullptr;
+    }
+
+    // Displays the node and its descendants in the showDetails format, without recursion
+    void showDetails(int indent = 0) const {
+        ChunkedOutput& output = detailsOutput();
+        std::vector<std::pair<const PersistentNode*, std::size_t>> stack{{this, static_cast<std::size_t>(indent)}};
+        while (!stack.empty()) {
+            auto [node, nodeIndent] = stack.back();
+            stack.pop_back();
+            output.appendDetailsLine(nodeIndent, node->isDir, node->name);
+            for (auto it = node->children.rbegin(); it != node->children.rend(); ++it) {
+                stack.push_back({it->get(), nodeIndent + 2});
+            }
+        }
+        output.flush();
+    }
+
+private:
+    friend class PersistentFilesystem;
 
-// Component interface: FilesystemComponent
-class FilesystemComponent {
+    std::string name;
+    bool isDir;
+    std::vector<Ptr> children;
+    std::uint64_t bytes;
+    std::uint64_t files;
+    std::uint32_t depth = 0;
+
+    std::vector<Ptr>::const_iterator lowerBound(std::string_view childName) const {
+        return std::lower_bound(children.begin(), children.end(), childName,
+                                [](const Ptr& child, std::string_view n) { return child->name < n; });
+    }
+
+    // A copy of this directory with its children replaced
+    Ptr withChildren(std::vector<Ptr> newChildren) const {
+        return std::make_shared<const PersistentNode>(Token{}, name, true, 0, std::move(newChildren));
+    }
+};
+
+PersistentNode::~PersistentNode() {
+    // Same explicit-stack teardown as ~Directory, so dropping a deep version cannot overflow
+    static thread_local std::vector<Ptr>* teardown = nullptr;
+    if (teardown != nullptr) {
+        std::move(children.begin(), children.end(), std::back_inserter(*teardown));
+        return;
+    }
+    std::vector<Ptr> doomed;
+    doomed.swap(children);
+    teardown = &doomed;
+    while (!doomed.empty()) {
+        Ptr node = std::move(doomed.back());
+        doomed.pop_back();
+        node.reset();
+    }
+    teardown = nullptr;
+}
+
+PersistentNode::Ptr PersistentNode::copyOf(const FilesystemComponent& root) {
+    // Post-order: when a directory comes up, its children are the top entries of `built`
+    std::vector<std::pair<std::size_t, Ptr>> built; // Depth, node
+    for (const TreeTraversal::Entry& entry : TreeTraversal(root, TreeTraversal::Order::PostOrder)) {
+        if (entry.node->asDirectory() == nullptr) {
+            built.push_back({entry.depth, file(entry.node->getName(), entry.node->totalBytes())});
+            continue;
+        }
+        std::vector<Ptr> children;
+        while (!built.empty() && built.back().first > entry.depth) {
+            children.push_back(std::move(built.back().second));
+            built.pop_back();
+        }
+        std::sort(children.begin(), children.end(),
+                  [](const Ptr& a, const Ptr& b) { return a->name < b->name; });
+        built.push_back({entry.depth, std::make_shared<const PersistentNode>(
+            Token{}, entry.node->getName(), true, 0, std::move(children))});
+    }
+    return built.back().second;
+}
+
+// Versioned handle on a tree of PersistentNodes. snapshot() returns the current root: an
+// immutable version that stays valid and unchanged for as long as the reader holds it.
+// add() and remove() build a new version by copying only the directories on the path to
+// the change, then publish it with one atomic pointer swap. Writers are serialized among
+// themselves, but readers never wait for a writer beyond that swap, and a version is freed
+// when its last snapshot is released.
+class PersistentFilesystem {
 public:
-    // Method to display the component's name (with indentation for hierarchy)
-    virtual void showDetails(int indent = 0) const = 0;
-    // Virtual destructor for safe polymorphic deletion
-    virtual ~FilesystemComponent() = default;
+    using Ptr = PersistentNode::Ptr;
+
+    explicit PersistentFilesystem(std::string rootName)
+        : root(PersistentNode::directory(std::move(rootName))) {}
+    explicit PersistentFilesystem(Ptr initial) : root(std::move(initial)) {}
+
+    Ptr snapshot() const { return std::atomic_load(&root); }
+
+    // Adds `node` to the directory at `directoryPath` (relative to the root; "" for the
+    // root itself); fails if there is no such directory or the name is taken
+    bool add(std::string_view directoryPath, Ptr node) {
+        if (!node) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(writerMutex);
+        return update(directoryPath, [&node](const PersistentNode& dir) -> Ptr {
+            auto position = dir.lowerBound(node->name);
+            if (position != dir.children.end() && (*position)->name == node->name) {
+                return nullptr;
+            }
+            std::vector<Ptr> children;
+            children.reserve(dir.children.size() + 1);
+            children.insert(children.end(), dir.children.begin(), position);
+            children.push_back(node);
+            children.insert(children.end(), position, dir.children.end());
+            return dir.withChildren(std::move(children));
+        });
+    }
+
+    // Removes the file or directory at `path`; fails if there is none
+    bool remove(std::string_view path) {
+        const std::size_t slash = path.find_last_of('/');
+        const std::string_view parentPath = slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+        const std::string_view childName = slash == std::string_view::npos ? path : path.substr(slash + 1);
+        std::lock_guard<std::mutex> lock(writerMutex);
+        return update(parentPath, [childName](const PersistentNode& dir) -> Ptr {
+            auto position = dir.lowerBound(childName);
+            if (position == dir.children.end() || (*position)->name != childName) {
+                return nullptr;
+            }
+            std::vector<Ptr> children;
+            children.reserve(dir.children.size() - 1);
+            children.insert(children.end(), dir.children.begin(), position);
+            children.insert(children.end(), position + 1, dir.children.end());
+            return dir.withChildren(std::move(children));
+        });
+    }
+
+private:
+    Ptr root; // Read with std::atomic_load, replaced with std::atomic_store
+    std::mutex writerMutex;
+
+    // Called with writerMutex held: applies `change` to the directory at `path` and copies
+    // each ancestor with its old child swapped for the new one, up to a new root
+    template <typename Change>
+    bool update(std::string_view path, Change change) {
+        std::vector<Ptr> chain{root}; // The root, then each directory down to the target
+        const bool found = forEachPathSegment(path, [&chain](std::string_view segment) {
+            Ptr next = chain.back()->find(segment);
+            if (!next || !next->isDir) {
+                return false;
+            }
+            chain.push_back(std::move(next));
+            return true;
+        });
+        if (!found || !chain.back()->isDir) {
+            return false;
+        }
+        Ptr replacement = change(*chain.back());
+        if (!replacement) {
+            return false;
+        }
+        for (std::size_t i = chain.size() - 1; i-- > 0;) {
+            const PersistentNode& parent = *chain[i];
+            std::vector<Ptr> children = parent.children;
+            children[parent.lowerBound(chain[i + 1]->name) - parent.children.begin()] = std::move(replacement);
+            replacement = parent.withChildren(std::move(children));
+        }
+        std::atomic_store(&root, std::move(replacement));
+        return true;
+    }
 };
 
-// Leaf: File
-class File : public FilesystemComponent {
+// Work-stealing thread pool: each worker owns a deque, pushes and pops its own work at
+// the back and steals from the front of other workers' deques when it runs dry.
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkStealingPool(unsigned threadCount = std::thread::hardware_concurrency()) {
+        if (threadCount == 0) {
+            threadCount = 1;
+        }
+        // One queue per worker plus a shared queue for tasks submitted by outside threads
+        for (unsigned i = 0; i <= threadCount; ++i) {
+            queues.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queues a task on the calling worker's deque (or the shared queue for other threads)
+    void submit(Task task) {
+        Queue& queue = *queues[ownQueueIndex()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        ++pending;
+        { std::lock_guard<std::mutex> lock(sleepMutex); } // Pairs with the wait predicate
+        wake.notify_one();
+    }
+
+    // Runs one queued task if any is available; lets waiting threads help instead of block
+    bool runPendingTask() {
+        Task task;
+        if (!takeTask(ownQueueIndex(), task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+    std::size_t threadCount() const { return workers.size(); }
+
 private:
-    std::string name;
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<std::size_t> pending{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static thread_local const WorkStealingPool* currentPool;
+    static thread_local std::size_t currentIndex;
+
+    std::size_t ownQueueIndex() const {
+        return currentPool == this ? currentIndex : queues.size() - 1;
+    }
+
+    // Pops from the back of our own queue, otherwise steals from the front of another
+    bool takeTask(std::size_t own, Task& task) {
+        {
+            Queue& queue = *queues[own];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                --pending;
+                return true;
+            }
+        }
+        for (std::size_t offset = 1; offset < queues.size(); ++offset) {
+            Queue& victim = *queues[(own + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(std::size_t index) {
+        currentPool = this;
+        currentIndex = index;
+        for (;;) {
+            if (runPendingTask()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || pending.load() != 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+};
+
+thread_local const WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+thread_local std::size_t WorkStealingPool::currentIndex = 0;
+
+// Tracks a set of tasks on a pool; wait() executes pool work until all of them finish
+class TaskGroup {
+private:
+    WorkStealingPool& pool;
+    std::atomic<std::size_t> outstanding{0};
 public:
-    explicit File(std::string name) : name(std::move(name)) {}
-    // Displays the file's name with indentation
-    void showDetails(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "File: " << name << std::endl;
+    explicit TaskGroup(WorkStealingPool& pool) : pool(pool) {}
+    ~TaskGroup() { wait(); }
+
+    void run(WorkStealingPool::Task task) {
+        ++outstanding;
+        pool.submit([this, task = std::move(task)] {
+            task();
+            --outstanding;
+        });
+    }
+
+    void wait() {
+        while (outstanding.load() != 0) {
+            if (!pool.runPendingTask()) {
+                std::this_thread::yield();
+            }
+        }
     }
 };
 
-// Composite: Directory
-class Directory : public FilesystemComponent {
+// Parallel reduction over a FilesystemComponent tree. map(const FilesystemComponent&) is
+// applied to every node and the results are combined with reduce(T, T), which must be
+// associative and commutative since subtrees finish in any order. A child directory holding
+// at least `grain` files in its subtree becomes its own task; smaller ones are walked inline.
+// Subtree size rather than fan-out decides, so a narrow but deep directory is still split
+// off and a wide directory of a few files is not. If map or reduce throws, on any thread,
+// the remaining tasks stop early and the first exception is rethrown once all have ended.
+template <typename T, typename Map, typename Reduce>
+T parallelReduce(WorkStealingPool& pool, const FilesystemComponent& root, T identity,
+                 Map map, Reduce reduce, std::uint64_t grain = 64) {
+    std::mutex partialsMutex;
+    std::vector<T> partials;
+    std::exception_ptr failure; // Guarded by partialsMutex
+    std::atomic<bool> failed{false};
+    TaskGroup group(pool);
+
+    std::function<void(const FilesystemComponent&)> runTask;
+    // Small subtrees are walked with an explicit stack of owning pointers, so a deep chain
+    // neither recurses nor loses a node to a lazy parent being unloaded in the meantime
+    auto walk = [&](const FilesystemComponent& subtree, T& acc) {
+        std::vector<std::shared_ptr<FilesystemComponent>> pending;
+        auto visit = [&](const FilesystemComponent& node) {
+            acc = reduce(std::move(acc), map(node));
+            if (const Directory* dir = node.asDirectory()) {
+                dir->forEachChildShared([&](const std::shared_ptr<FilesystemComponent>& child) {
+                    const Directory* childDir = child->asDirectory();
+                    if (childDir != nullptr && childDir->fileCount() >= grain) {
+                        group.run([&runTask, child] { runTask(*child); });
+                    } else {
+                        pending.push_back(child);
+                    }
+                });
+            }
+        };
+        visit(subtree);
+        while (!pending.empty()) {
+            std::shared_ptr<FilesystemComponent> node = std::move(pending.back());
+            pending.pop_back();
+            visit(*node);
+        }
+    };
+    // Never lets an exception escape: a worker thread could not report it, and on this
+    // thread it would destroy walk and runTask while queued tasks still refer to them
+    runTask = [&](const FilesystemComponent& subtree) {
+        if (failed.load(std::memory_order_relaxed)) {
+            return;
+        }
+        try {
+            T acc = identity;
+            walk(subtree, acc);
+            std::lock_guard<std::mutex> lock(partialsMutex);
+            partials.push_back(std::move(acc));
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(partialsMutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+            failed.store(true, std::memory_order_relaxed);
+        }
+    };
+
+    runTask(root);
+    group.wait();
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+
+    T result = identity;
+    for (auto& partial : partials) {
+        result = reduce(std::move(result), std::move(partial));
+    }
+    return result;
+}
+
+// Matches a name against a shell-style glob: '*' matches any run of characters, '?' any
+// one character, and [abc], [a-z] or [!abc] one character from (or not from) a set. A '['
+// without a closing ']' is literal. Backtracks only to the latest '*', so it is linear
+// in the name for patterns with a single star.
+bool globMatch(std::string_view pattern, std::string_view name) {
+    // Matches one pattern element at `p` against c, advancing p past the element
+    auto matchOne = [&pattern](std::size_t& p, char c) {
+        if (pattern[p] == '?') {
+            ++p;
+            return true;
+        }
+        const std::size_t close = pattern[p] == '[' ? pattern.find(']', p + 2) : std::string_view::npos;
+        if (close == std::string_view::npos) {
+            return pattern[p++] == c;
+        }
+        std::size_t i = p + 1;
+        const bool negate = pattern[i] == '!' || pattern[i] == '^';
+        i += negate;
+        bool found = false;
+        for (; i < close; ++i) {
+            if (i + 2 < close && pattern[i + 1] == '-') {
+                found = found || (pattern[i] <= c && c <= pattern[i + 2]);
+                i += 2;
+            } else {
+                found = found || pattern[i] == c;
+            }
+        }
+        p = close + 1;
+        return found != negate;
+    };
+    std::size_t p = 0;
+    std::size_t n = 0;
+    std::size_t starP = std::string_view::npos;
+    std::size_t starN = 0;
+    while (n < name.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            starP = ++p;
+            starN = n;
+            continue;
+        }
+        std::size_t next = p;
+        if (p < pattern.size() && matchOne(next, name[n])) {
+            p = next;
+            ++n;
+            continue;
+        }
+        if (starP == std::string_view::npos) {
+            return false;
+        }
+        p = starP;
+        n = ++starN;
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+// What searchTree looks for: a glob on the name, a predicate on the component, or both.
+// A glob whose literal tail contains a '.' (as in "*.jpg") fixes the extension of every
+// matching name, so directories whose name index lacks that extension are skipped whole.
+class SearchQuery {
+public:
+    using Predicate = std::function<bool(const FilesystemComponent&)>;
+
+    static SearchQuery glob(std::string pattern) {
+        SearchQuery query;
+        const std::size_t wildcard = pattern.find_last_of("*?[]");
+        const std::string_view tail = std::string_view(pattern).substr(
+            wildcard == std::string::npos ? 0 : wildcard + 1);
+        query.extensionBit = nameExtensionBit(tail);
+        query.pattern = std::move(pattern);
+        query.hasPattern = true;
+        return query;
+    }
+    static SearchQuery matching(Predicate predicate) {
+        SearchQuery query;
+        query.predicate = std::move(predicate);
+        return query;
+    }
+    // Additionally requires `extra` to accept the component
+    SearchQuery where(Predicate extra) && {
+        if (predicate) {
+            predicate = [first = std::move(predicate), extra = std::move(extra)](const FilesystemComponent& c) {
+                return first(c) && extra(c);
+            };
+        } else {
+            predicate = std::move(extra);
+        }
+        return std::move(*this);
+    }
+
+    bool matches(const FilesystemComponent& component) const {
+        return (!hasPattern || globMatch(pattern, component.getName())) &&
+               (!predicate || predicate(component));
+    }
+    // False when nothing below `dir` can match
+    bool mayMatchBelow(const Directory& dir) const {
+        return extensionBit == 0 || dir.mayContainExtension(extensionBit);
+    }
+
 private:
-    std::string name;
-    std::vector<std::shared_ptr<FilesystemComponent>> children;
+    std::string pattern;
+    bool hasPattern = false;
+    Predicate predicate;
+    std::uint64_t extensionBit = 0; // 0 when the glob does not fix an extension
+};
+
+// Finds every component below `root` that matches `query`, calling
+// onMatch(const std::shared_ptr<FilesystemComponent>&) for each as soon as it is found.
+// Child directories holding at least `grain` files are searched as separate pool tasks;
+// onMatch calls are serialized but arrive in no particular order. Returns the match count.
+template <typename OnMatch>
+std::size_t searchTree(WorkStealingPool& pool, const Directory& root, const SearchQuery& query,
+                       OnMatch onMatch, std::uint64_t grain = 256) {
+    std::mutex deliveryMutex;
+    std::atomic<std::size_t> matches{0};
+    TaskGroup group(pool);
+
+    std::function<void(const Directory&)> scan = [&](const Directory& subtree) {
+        std::vector<std::shared_ptr<FilesystemComponent>> pending; // Directories left to scan
+        auto scanChildren = [&](const Directory& dir) {
+            const std::size_t firstQueued = pending.size();
+            dir.forEachChildShared([&](const std::shared_ptr<FilesystemComponent>& child) {
+                if (query.matches(*child)) {
+                    ++matches;
+                    std::lock_guard<std::mutex> lock(deliveryMutex);
+                    onMatch(child);
+                }
+                const Directory* childDir = child->asDirectory();
+                if (childDir == nullptr || !query.mayMatchBelow(*childDir)) {
+                    return;
+                }
+                if (childDir->fileCount() >= grain) {
+                    group.run([&scan, child] { scan(*child->asDirectory()); });
+                } else {
+                    pending.push_back(child);
+                }
+            });
+            // Pop subdirectories in their original order
+            std::reverse(pending.begin() + static_cast<std::ptrdiff_t>(firstQueued), pending.end());
+        };
+        scanChildren(subtree);
+        while (!pending.empty()) {
+            std::shared_ptr<FilesystemComponent> dir = std::move(pending.back());
+            pending.pop_back();
+            scanChildren(*dir->asDirectory());
+        }
+    };
+
+    if (query.mayMatchBelow(root)) {
+        scan(root);
+    }
+    group.wait();
+    return matches.load();
+}
+
+// Reads every entry of an open directory, calling fn(name, isDirectory) for each.
+// On Linux entries arrive in 64 KiB getdents64 batches; elsewhere readdir is used.
+template <typename Fn>
+bool readDirectoryEntries(int dirFd, Fn&& fn) {
+    auto isDirectory = [dirFd](const char* entryName, unsigned char type) {
+        if (type != DT_UNKNOWN) {
+            return type == DT_DIR;
+        }
+        struct stat info;
+        return fstatat(dirFd, entryName, &info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(info.st_mode);
+    };
+    auto isDotEntry = [](const char* entryName) {
+        return entryName[0] == '.' &&
+               (entryName[1] == '\0' || (entryName[1] == '.' && entryName[2] == '\0'));
+    };
+#if defined(__linux__)
+    struct LinuxDirent64 {
+        std::uint64_t ino;
+        std::int64_t off;
+        unsigned short reclen;
+        unsigned char type;
+        char name[1];
+    };
+    alignas(8) char buffer[64 * 1024];
+    for (;;) {
+        long bytes = syscall(SYS_getdents64, dirFd, buffer, sizeof(buffer));
+        if (bytes < 0) {
+            return false;
+        }
+        if (bytes == 0) {
+            return true;
+        }
+        for (long offset = 0; offset < bytes;) {
+            auto* entry = reinterpret_cast<LinuxDirent64*>(buffer + offset);
+            offset += entry->reclen;
+            if (!isDotEntry(entry->name)) {
+                fn(entry->name, isDirectory(entry->name, entry->type));
+            }
+        }
+    }
+#else
+    int ownFd = dup(dirFd); // closedir() closes the descriptor it was given
+    DIR* dir = ownFd >= 0 ? fdopendir(ownFd) : nullptr;
+    if (dir == nullptr) {
+        if (ownFd >= 0) close(ownFd);
+        return false;
+    }
+    while (dirent* entry = readdir(dir)) {
+        if (!isDotEntry(entry->d_name)) {
+            fn(entry->d_name, isDirectory(entry->d_name, entry->d_type));
+        }
+    }
+    closedir(dir);
+    return true;
+#endif
+}
+
+// Imports the directory tree at `path` into a new Directory, scanning every subdirectory
+// as its own pool task and opening it relative to its parent's descriptor. Each directory
+// is filled completely (children reserved up front) before it is attached to its parent,
+// so add() never has more than one level of aggregates to update. Symlinks are imported
+// as zero-byte files and not followed; entries that cannot be read are counted in `errors`.
+// Queued subdirectories keep their parent's descriptor open only while fewer than
+// kImportFdBudget are open; past that they are opened by full path instead.
+struct ImportStats {
+    std::atomic<std::uint64_t> files{0};
+    std::atomic<std::uint64_t> directories{0};
+    std::atomic<std::uint64_t> errors{0};
+    std::atomic<std::uint64_t> unopened{0}; // Subdirectories imported empty: open failed
+};
+
+constexpr int kImportFdBudget = 256;
+
+std::shared_ptr<Directory> importDirectory(WorkStealingPool& pool, const std::string& path,
+                                           ImportStats& stats, bool readSizes = true) {
+    std::atomic<int> openFds{0};
+    struct FdHandle {
+        int fd;
+        std::atomic<int>& openCount;
+        FdHandle(int fd, std::atomic<int>& openCount) : fd(fd), openCount(openCount) { ++openCount; }
+        ~FdHandle() {
+            if (fd >= 0) close(fd);
+            --openCount;
+        }
+    };
+    // One per directory; completes once its own scan and all subdirectory jobs are done
+    struct Job {
+        std::shared_ptr<Directory> dir;
+        std::string path;
+        std::shared_ptr<Job> parent;
+        std::vector<std::shared_ptr<Directory>> subdirs;
+        std::atomic<std::size_t> pending{1};
+    };
+
+    TaskGroup group(pool);
+    std::function<void(std::shared_ptr<Job>, int)> scan;
+
+    // Attaches finished subdirectories, then reports completion up the job chain
+    auto finish = [](std::shared_ptr<Job> job) {
+        while (job && --job->pending == 0) {
+            for (auto& subdir : job->subdirs) {
+                job->dir->add(subdir);
+            }
+            job->subdirs.clear();
+            job = job->parent;
+        }
+    };
+
+    scan = [&](std::shared_ptr<Job> job, int rawFd) {
+        auto fd = std::make_shared<FdHandle>(rawFd, openFds);
+        stats.directories++;
+        std::vector<std::pair<std::string, bool>> entries;
+        if (!readDirectoryEntries(fd->fd, [&entries](const char* entryName, bool isDir) {
+                entries.emplace_back(entryName, isDir);
+            })) {
+            stats.errors++;
+        }
+        job->dir->reserve(entries.size());
+        std::vector<std::string> subdirNames;
+        for (auto& entry : entries) {
+            if (entry.second) {
+                subdirNames.push_back(std::move(entry.first));
+                continue;
+            }
+            std::uint64_t size = 0;
+            struct stat info;
+            if (readSizes && fstatat(fd->fd, entry.first.c_str(), &info, AT_SYMLINK_NOFOLLOW) == 0 &&
+                S_ISREG(info.st_mode)) {
+                size = static_cast<std::uint64_t>(info.st_size);
+            }
+            job->dir->add(std::make_shared<File>(std::move(entry.first), size));
+            stats.files++;
+        }
+        job->pending += subdirNames.size();
+        job->subdirs.reserve(subdirNames.size());
+        // Every queued task holding the parent open could otherwise exhaust descriptors
+        std::shared_ptr<FdHandle> parentFd = openFds.load() < kImportFdBudget ? fd : nullptr;
+        for (auto& subdirName : subdirNames) {
+            auto child = std::make_shared<Job>();
+            child->dir = std::make_shared<Directory>(subdirName);
+            child->path = job->path + '/' + subdirName;
+            child->parent = job;
+            job->subdirs.push_back(child->dir);
+            group.run([&, child, parentFd, subdirName = std::move(subdirName)] {
+                const int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+                int childFd = parentFd ? openat(parentFd->fd, subdirName.c_str(), flags)
+                                       : open(child->path.c_str(), flags);
+                if (childFd < 0) {
+                    stats.errors++;
+                    stats.unopened++;
+                    finish(child);
+                    return;
+                }
+                scan(child, childFd);
+            });
+        }
+        fd.reset();
+        finish(job);
+    };
+
+    int rootFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd < 0) {
+        stats.errors++;
+        return nullptr;
+    }
+    auto rootJob = std::make_shared<Job>();
+    rootJob->path = path;
+    std::string rootName = std::filesystem::path(path).filename().string();
+    rootJob->dir = std::make_shared<Directory>(rootName.empty() ? path : rootName);
+    scan(rootJob, rootFd);
+    group.wait();
+    return rootJob->dir;
+}
+
+// Builds the same tree the way client code would by hand: one add at a time, using
+// std::filesystem. Serves as the baseline for the import benchmark.
+std::shared_ptr<Directory> importDirectorySequentially(const std::filesystem::path& path) {
+    auto dir = std::make_shared<Directory>(path.filename().string());
+    for (const auto& entry : std::filesystem::directory_iterator(path)) {
+        if (entry.is_directory() && !entry.is_symlink()) {
+            dir->add(importDirectorySequentially(entry.path()));
+        } else {
+            std::error_code error;
+            std::uint64_t size = entry.is_regular_file() && !entry.is_symlink() ? entry.file_size(error) : 0;
+            dir->add(std::make_shared<File>(entry.path().filename().string(), size));
+        }
+    }
+    return dir;
+}
+
+// Binary tree file, written by writeTreeFile and read in place by MappedTree:
+//
+//     TreeFileHeader                      32 bytes
+//     TreeFileNode[nodeCount]             24 bytes each, in pre-order
+//     string table                        every distinct name once, unterminated
+//
+// A node's subtree occupies the nodeCount entries starting at the node itself, so its
+// first child (if any) is the next entry and its next sibling is subtreeSize entries on.
+// Integers are stored in native byte order; byteOrder rejects files from the other kind
+// of machine.
+struct TreeFileHeader {
+    char magic[8];             // "CMPTREE1"
+    std::uint32_t byteOrder;   // kTreeFileByteOrder as written
+    std::uint32_t nodeCount;
+    std::uint64_t stringsOffset;
+    std::uint64_t stringsSize;
+};
+
+struct TreeFileNode {
+    std::uint64_t size;        // File size, or a directory's totalBytes()
+    std::uint32_t nameOffset;  // Into the string table
+    std::uint32_t nameLength;  // High bit set for directories
+    std::uint32_t subtreeSize; // Nodes in this subtree, itself included
+    std::uint32_t parent;      // Index of the parent node; 0xFFFFFFFF for the root
+};
+
+static_assert(sizeof(TreeFileHeader) == 32 && sizeof(TreeFileNode) == 24, "tree file layout");
+
+constexpr char kTreeFileMagic[8] = {'C', 'M', 'P', 'T', 'R', 'E', 'E', '1'};
+constexpr std::uint32_t kTreeFileByteOrder = 0x01020304u;
+constexpr std::uint32_t kTreeFileDirectoryBit = 0x80000000u;
+
+// Writes the tree rooted at `root` to `path` in the format above; returns false if the
+// file cannot be written or the tree exceeds the format's 32-bit limits. Names that occur
+// several times are stored once.
+bool writeTreeFile(const FilesystemComponent& root, const std::string& path) {
+    std::vector<TreeFileNode> nodes;
+    std::string strings;
+    std::unordered_map<std::string, std::uint32_t> stringOffsets;
+    std::vector<std::uint32_t> open; // Directories whose subtree is still being written
+    for (const TreeTraversal::Entry& entry : TreeTraversal(root, TreeTraversal::Order::PreOrder)) {
+        while (open.size() > entry.depth) {
+            nodes[open.back()].subtreeSize = static_cast<std::uint32_t>(nodes.size() - open.back());
+            open.pop_back();
+        }
+        const std::string& name = entry.node->getName();
+        auto known = stringOffsets.find(name);
+        if (known == stringOffsets.end()) {
+            if (strings.size() + name.size() >= kTreeFileDirectoryBit) {
+                return false;
+            }
+            known = stringOffsets.emplace(name, static_cast<std::uint32_t>(strings.size())).first;
+            strings.append(name);
+        }
+        if (nodes.size() == 0xFFFFFFFFu) {
+            return false;
+        }
+        TreeFileNode node;
+        node.size = entry.node->totalBytes();
+        node.nameOffset = known->second;
+        node.nameLength = static_cast<std::uint32_t>(name.size());
+        node.subtreeSize = 1;
+        node.parent = open.empty() ? 0xFFFFFFFFu : open.back();
+        if (entry.node->asDirectory() != nullptr) {
+            node.nameLength |= kTreeFileDirectoryBit;
+            open.push_back(static_cast<std::uint32_t>(nodes.size()));
+        }
+        nodes.push_back(node);
+    }
+    for (; !open.empty(); open.pop_back()) {
+        nodes[open.back()].subtreeSize = static_cast<std::uint32_t>(nodes.size() - open.back());
+    }
+
+    TreeFileHeader header;
+    std::copy(std::begin(kTreeFileMagic), std::end(kTreeFileMagic), header.magic);
+    header.byteOrder = kTreeFileByteOrder;
+    header.nodeCount = static_cast<std::uint32_t>(nodes.size());
+    header.stringsOffset = sizeof(TreeFileHeader) + nodes.size() * sizeof(TreeFileNode);
+    header.stringsSize = strings.size();
+
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    auto writeAll = [fd](const void* data, std::size_t length) {
+        const char* bytes = static_cast<const char*>(data);
+        while (length > 0) {
+            const ssize_t written = ::write(fd, bytes, length);
+            if (written < 0) {
+                return false;
+            }
+            bytes += written;
+            length -= static_cast<std::size_t>(written);
+        }
+        return true;
+    };
+    const bool ok = writeAll(&header, sizeof(header)) &&
+                    writeAll(nodes.data(), nodes.size() * sizeof(TreeFileNode)) &&
+                    writeAll(strings.data(), strings.size());
+    return ::close(fd) == 0 && ok;
+}
+
+// Read-only view of a tree file, mapped into memory rather than parsed: names are
+// string_views into the mapping and navigation is index arithmetic over the node array,
+// so opening costs the same for any tree size. Offsets and counts read from the file are
+// bounds-checked, so a damaged file gives wrong answers, never out-of-range reads. Call
+// materialize() for a mutable Directory tree.
+class MappedTree {
 public:
-    explicit Directory(std::string name) : name(std::move(name)) {}
-    // Adds a child component (file or directory)
-    void add(const std::shared_ptr<FilesystemComponent>& component) {
-        children.push_back(component);
+    using NodeId = std::uint32_t;
+    static constexpr NodeId npos = 0xFFFFFFFFu;
+
+    MappedTree() = default;
+    MappedTree(const MappedTree&) = delete;
+    MappedTree& operator=(const MappedTree&) = delete;
+    ~MappedTree() { close(); }
+
+    // Maps the file at `path`; returns false if it cannot be read or is not a tree file
+    bool open(const std::string& path) {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<std::uint64_t>(info.st_size) < sizeof(TreeFileHeader)) {
+            ::close(fd);
+            return false;
+        }
+        const std::size_t length = static_cast<std::size_t>(info.st_size);
+        void* data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        mapping = static_cast<const char*>(data);
+        mappedLength = length;
+
+        const auto* header = reinterpret_cast<const TreeFileHeader*>(mapping);
+        const std::uint64_t nodesEnd =
+            sizeof(TreeFileHeader) + std::uint64_t(header->nodeCount) * sizeof(TreeFileNode);
+        if (!std::equal(std::begin(kTreeFileMagic), std::end(kTreeFileMagic), header->magic) ||
+            header->byteOrder != kTreeFileByteOrder || header->nodeCount == 0 ||
+            header->stringsOffset < nodesEnd || header->stringsOffset > length ||
+            header->stringsSize > length - header->stringsOffset) {
+            close();
+            return false;
+        }
+        nodes = reinterpret_cast<const TreeFileNode*>(mapping + sizeof(TreeFileHeader));
+        count = header->nodeCount;
+        strings = std::string_view(mapping + header->stringsOffset, header->stringsSize);
+        return true;
     }
-    // Removes a child component (removes all occurrences)
-    void remove(const std::shared_ptr<FilesystemComponent>& component) {
-        children.erase(std::remove(children.begin(), children.end(), component), children.end());
+
+    void close() {
+        if (mapping != nullptr) {
+            munmap(const_cast<char*>(mapping), mappedLength);
+        }
+        mapping = nullptr;
+        nodes = nullptr;
+        count = 0;
+        strings = {};
     }
-    // Displays the directory's name and its children with indentation
-    void showDetails(int indent = 0) const override {
-        std::cout << std::string(indent, ' ') << "Directory: " << name << std::endl;
-        for (const auto& child : children) {
-            child->showDetails(indent + 2);
+
+    bool isOpen() const { return mapping != nullptr; }
+    std::size_t size() const { return count; }
+    NodeId root() const { return count == 0 ? npos : 0; }
+
+    std::string_view name(NodeId id) const {
+        const std::uint32_t offset = nodes[id].nameOffset;
+        const std::uint32_t length = nodes[id].nameLength & ~kTreeFileDirectoryBit;
+        return offset <= strings.size() ? strings.substr(offset, length) : std::string_view();
+    }
+    bool isDirectory(NodeId id) const { return (nodes[id].nameLength & kTreeFileDirectoryBit) != 0; }
+    // File size, or the total bytes below a directory when it was written
+    std::uint64_t bytes(NodeId id) const { return nodes[id].size; }
+    // Nodes in the subtree rooted at `id`, itself included
+    std::uint32_t subtreeSize(NodeId id) const {
+        return std::max<std::uint32_t>(1, std::min<std::uint32_t>(nodes[id].subtreeSize, count - id));
+    }
+    NodeId parent(NodeId id) const { return nodes[id].parent < id ? nodes[id].parent : npos; }
+    NodeId firstChild(NodeId id) const {
+        return isDirectory(id) && subtreeSize(id) > 1 ? id + 1 : npos;
+    }
+    // Skips the whole subtree of `id` in one step
+    NodeId nextSibling(NodeId id) const {
+        const NodeId up = parent(id);
+        if (up == npos) {
+            return npos;
+        }
+        const std::uint64_t next = std::uint64_t(id) + subtreeSize(id);
+        return next < std::uint64_t(up) + subtreeSize(up) ? static_cast<NodeId>(next) : npos;
+    }
+
+    // Returns the child of `directory` with the given name, or npos
+    NodeId find(NodeId directory, std::string_view childName) const {
+        for (NodeId child = firstChild(directory); child != npos; child = nextSibling(child)) {
+            if (name(child) == childName) {
+                return child;
+            }
+        }
+        return npos;
+    }
+
+    // Resolves a slash-separated path relative to `directory`, like Directory::resolve
+    NodeId resolve(NodeId directory, std::string_view path) const {
+        NodeId current = directory;
+        const bool found = forEachPathSegment(path, [&](std::string_view segment) {
+            current = find(current, segment);
+            return current != npos;
+        });
+        return found ? current : npos;
+    }
+
+    // Displays a node and its descendants in the showDetails format. Pre-order storage
+    // makes this one forward scan; `ends` tracks where each open directory finishes.
+    void showDetails(NodeId root, int indent = 0) const {
+        ChunkedOutput& output = detailsOutput();
+        std::vector<std::uint64_t> ends;
+        const std::uint64_t last = std::uint64_t(root) + subtreeSize(root);
+        for (std::uint64_t id = root; id < last; ++id) {
+            while (!ends.empty() && ends.back() <= id) {
+                ends.pop_back();
+            }
+            const NodeId node = static_cast<NodeId>(id);
+            output.appendDetailsLine(static_cast<std::size_t>(indent) + 2 * ends.size(), isDirectory(node), name(node));
+            if (isDirectory(node)) {
+                ends.push_back(id + subtreeSize(node));
+            }
+        }
+        output.flush();
+    }
+
+    // Builds a mutable copy of the subtree rooted at `id`. Nodes are created from the last
+    // to the first, so every directory is filled with its already-built children before it
+    // gets a parent, and each add() updates one level of aggregates instead of a whole path.
+    std::shared_ptr<FilesystemComponent> materialize(NodeId id = 0) const {
+        if (id >= count) {
+            return nullptr;
         }
+        struct Built {
+            std::uint64_t index;
+            std::shared_ptr<FilesystemComponent> component;
+        };
+        std::vector<Built> built;
+        std::vector<std::shared_ptr<FilesystemComponent>> children;
+        for (std::uint64_t i = std::uint64_t(id) + subtreeSize(id); i-- > id;) {
+            const NodeId node = static_cast<NodeId>(i);
+            if (!isDirectory(node)) {
+                built.push_back({i, std::make_shared<File>(std::string(name(node)), bytes(node))});
+                continue;
+            }
+            // Unattached nodes inside this directory's range are its children, first child on top
+            const std::uint64_t end = i + subtreeSize(node);
+            children.clear();
+            while (!built.empty() && built.back().index < end) {
+                children.push_back(std::move(built.back().component));
+                built.pop_back();
+            }
+            auto dir = std::make_shared<Directory>(std::string(name(node)));
+            dir->reserve(children.size());
+            for (const auto& child : children) {
+                dir->add(child);
+            }
+            built.push_back({i, std::move(dir)});
+        }
+        return built.empty() ? nullptr : std::move(built.back().component);
     }
+
+private:
+    const char* mapping = nullptr;
+    std::size_t mappedLength = 0;
+    const TreeFileNode* nodes = nullptr;
+    std::uint32_t count = 0;
+    std::string_view strings;
 };
 
+// Generates a tree of `fileCount` files (1000 per leaf directory, 32 leaves per group)
+// in a temporary directory, then times the sequential baseline against importDirectory.
+int runImportBenchmark(std::uint64_t fileCount) {
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+    std::string scratch = (std::filesystem::temp_directory_path() / "composite-bench-XXXXXX").string();
+    if (mkdtemp(&scratch[0]) == nullptr) {
+        std::cerr << "Could not create a scratch directory" << std::endl;
+        return 1;
+    }
+    std::cout << "Generating " << fileCount << " files under " << scratch << "..." << std::endl;
+    const std::uint64_t filesPerLeaf = 1000;
+    const std::uint64_t leavesPerGroup = 32;
+    std::uint64_t created = 0;
+    for (std::uint64_t leaf = 0; created < fileCount; ++leaf) {
+        std::filesystem::path leafPath = std::filesystem::path(scratch) /
+            ("group" + std::to_string(leaf / leavesPerGroup)) / ("leaf" + std::to_string(leaf));
+        std::filesystem::create_directories(leafPath);
+        int leafFd = open(leafPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        for (std::uint64_t i = 0; i < filesPerLeaf && created < fileCount; ++i, ++created) {
+            std::string fileName = "file" + std::to_string(i) + ".dat";
+            int fd = openat(leafFd, fileName.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+            if (fd >= 0) {
+                if (ftruncate(fd, static_cast<off_t>(i % 4096)) != 0) {
+                    // Sizes only make the totals non-trivial; an unsized file is fine
+                }
+                close(fd);
+            }
+        }
+        close(leafFd);
+    }
+
+    auto start = Clock::now();
+    auto baseline = importDirectorySequentially(scratch);
+    double baselineTime = seconds(Clock::now() - start);
+    std::cout << "Sequential add():   " << baseline->fileCount() << " files in "
+              << baselineTime << " s" << std::endl;
+    baseline.reset();
+
+    std::vector<unsigned> threadCounts{1};
+    if (std::thread::hardware_concurrency() > 1) {
+        threadCounts.push_back(std::thread::hardware_concurrency());
+    }
+    for (unsigned threads : threadCounts) {
+        WorkStealingPool pool(threads);
+        ImportStats stats;
+        start = Clock::now();
+        auto imported = importDirectory(pool, scratch, stats);
+        double importTime = seconds(Clock::now() - start);
+        std::cout << "importDirectory (" << threads << " thread" << (threads == 1 ? "" : "s")
+                  << "): " << imported->fileCount() << " files, " << stats.directories
+                  << " directories, " << imported->totalBytes() << " bytes in " << importTime
+                  << " s (" << static_cast<std::uint64_t>(stats.files / importTime)
+                  << " files/s, " << baselineTime / importTime << "x)";
+        if (stats.errors > 0) {
+            std::cout << ", " << stats.errors << " errors (" << stats.unopened
+                      << " directories not opened)";
+        }
+        std::cout << std::endl;
+    }
+
+    std::filesystem::remove_all(scratch);
+    return 0;
+}
+
+// Times the round trip through a tree file for a generated tree of `fileCount` files,
+// against building the same tree with make_shared and add()
+int runSerializeBenchmark(std::uint64_t fileCount) {
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+
+    auto start = Clock::now();
+    auto root = std::make_shared<Directory>("bench");
+    std::shared_ptr<Directory> group;
+    std::uint64_t created = 0;
+    for (std::uint64_t leaf = 0; created < fileCount; ++leaf) {
+        if (leaf % 32 == 0) {
+            group = std::make_shared<Directory>("group" + std::to_string(leaf / 32));
+            root->add(group);
+        }
+        auto leafDir = std::make_shared<Directory>("leaf" + std::to_string(leaf));
+        for (std::uint64_t i = 0; i < 1000 && created < fileCount; ++i, ++created) {
+            leafDir->add(std::make_shared<File>("file" + std::to_string(i) + ".dat", i % 4096));
+        }
+        group->add(leafDir);
+    }
+    std::cout << "Build with add():   " << root->fileCount() << " files in "
+              << seconds(Clock::now() - start) << " s" << std::endl;
+
+    const std::string path = (std::filesystem::temp_directory_path() / "composite-bench.tree").string();
+    start = Clock::now();
+    if (!writeTreeFile(*root, path)) {
+        std::cerr << "Could not write " << path << std::endl;
+        return 1;
+    }
+    std::cout << "writeTreeFile:      " << std::filesystem::file_size(path) << " bytes in "
+              << seconds(Clock::now() - start) << " s" << std::endl;
+    root.reset();
+
+    start = Clock::now();
+    MappedTree mapped;
+    if (!mapped.open(path)) {
+        std::cerr << "Could not map " << path << std::endl;
+        return 1;
+    }
+    const double openTime = seconds(Clock::now() - start);
+    start = Clock::now();
+    std::uint64_t bytes = 0;
+    for (MappedTree::NodeId id = 0; id < mapped.size(); ++id) {
+        bytes += mapped.isDirectory(id) ? 0 : mapped.bytes(id);
+    }
+    std::cout << "MappedTree::open:   " << openTime << " s; scan of " << mapped.size()
+              << " nodes (" << bytes << " bytes) in " << seconds(Clock::now() - start) << " s" << std::endl;
+
+    start = Clock::now();
+    auto materialized = mapped.materialize();
+    std::cout << "materialize():      " << materialized->fileCount() << " files in "
+              << seconds(Clock::now() - start) << " s" << std::endl;
+
+    mapped.close();
+    std::filesystem::remove(path);
+    return 0;
+}
+
 // Main function to demonstrate the Composite pattern
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench-import") {
+        return runImportBenchmark(argc > 2 ? std::stoull(argv[2]) : 1000000);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-serialize") {
+        return runSerializeBenchmark(argc > 2 ? std::stoull(argv[2]) : 1000000);
+    }
+
     // Create files (leaves)
-    auto file1 = std::make_shared<File>("Document.txt");
-    auto file2 = std::make_shared<File>("Photo.jpg");
-    auto file3 = std::make_shared<File>("Presentation.pptx");
+    auto file1 = std::make_shared<File>("Document.txt", 12000);
+    auto file2 = std::make_shared<File>("Photo.jpg", 2400000);
+    auto file3 = std::make_shared<File>("Presentation.pptx", 860000);
 
     // Create directories (composites)
     auto dir1 = std::make_shared<Directory>("Documents");
@@ -92,13 +2947,186 @@ int main() {
     rootDir->showDetails();
     std::cout << std::endl;
 
+    // Look a child up by name, and a descendant by path
+    if (auto photos = rootDir->find("Photos")) {
+        std::cout << "Found by name: " << photos->getName() << std::endl;
+    }
+    if (auto slides = rootDir->resolve("Photos/Presentation.pptx")) {
+        std::cout << "Resolved path: Photos/Presentation.pptx -> " << slides->getName() << std::endl;
+    }
+    std::cout << std::endl;
+
     // Add a new file to the root directory
-    auto file4 = std::make_shared<File>("Readme.txt");
+    auto file4 = std::make_shared<File>("Readme.txt", 1500);
     rootDir->add(file4);
     std::cout << "Updated Filesystem Structure after adding Readme.txt:" << std::endl;
     rootDir->showDetails();
     std::cout << std::endl;
 
+    // Render the same tree as JSON through the buffered renderer
+    std::cout << "Filesystem Structure as JSON:" << std::endl;
+    TreeRenderer(std::cout).render(*rootDir, TreeRenderer::Format::Json);
+    std::cout << std::endl;
+
+    // Walk the tree in each order through iterators that share one explicit stack
+    TraversalStack traversalStack;
+    const std::pair<const char*, TreeTraversal::Order> orders[] = {
+        {"Pre-order", TreeTraversal::Order::PreOrder},
+        {"Post-order", TreeTraversal::Order::PostOrder},
+        {"Breadth-first", TreeTraversal::Order::BreadthFirst},
+    };
+    for (const auto& [label, order] : orders) {
+        std::cout << label << ":";
+        for (const TreeTraversal::Entry& entry : TreeTraversal(*rootDir, order, traversalStack)) {
+            std::cout << " " << entry.node->getName();
+        }
+        std::cout << std::endl;
+    }
+
+    // A chain of 100,000 nested directories is traversed, rendered as JSON and destroyed
+    // without recursing once per level
+    auto chain = std::make_shared<Directory>("Level");
+    for (int level = 0; level < 100000; ++level) {
+        auto above = std::make_shared<Directory>("Level");
+        above->add(chain);
+        chain = above;
+    }
+    std::size_t deepest = 0;
+    for (const TreeTraversal::Entry& entry : TreeTraversal(*chain, TreeTraversal::Order::PostOrder, traversalStack)) {
+        deepest = std::max(deepest, entry.depth);
+    }
+    std::ostringstream rendered;
+    TreeRenderer(rendered).render(*chain, TreeRenderer::Format::Json);
+    std::cout << "Deep chain: " << deepest << " levels, " << rendered.str().size()
+              << " bytes rendered" << std::endl;
+    chain.reset();
+    std::cout << std::endl;
+
+    // Lazy directories load their children on first access; with a budget of four loaded
+    // children, opening one year's reports unloads the other year's
+    LazyDirectoryCache lazyCache(4);
+    int loads = 0;
+    auto archive = std::make_shared<Directory>("Archive");
+    for (int year : {2023, 2024}) {
+        archive->add(std::make_shared<Directory>(std::to_string(year), [year, &loads](Directory& dir) {
+            ++loads;
+            for (int quarter = 1; quarter <= 3; ++quarter) {
+                dir.add(std::make_shared<File>("Report-" + std::to_string(year) + "-Q" +
+                                               std::to_string(quarter) + ".pdf", 40000));
+            }
+        }, &lazyCache));
+    }
+    std::cout << "Lazy Archive (loads so far: " << loads << "):" << std::endl;
+    archive->showDetails();
+    std::cout << "Loads: " << loads << ", children in memory: " << lazyCache.loadedChildren()
+              << ", archive bytes: " << archive->totalBytes() << std::endl;
+    std::cout << std::endl;
+
+    // Subtree totals are kept up to date by add/remove, so these are O(1) reads
+    std::cout << "Root totals: " << rootDir->fileCount() << " files, "
+              << rootDir->totalBytes() << " bytes, depth " << rootDir->maxDepth() << std::endl;
+    std::cout << std::endl;
+
+    // Aggregate over the tree in parallel: count files and find names containing "Readme"
+    WorkStealingPool pool;
+    auto plus = [](std::size_t a, std::size_t b) { return a + b; };
+    std::size_t fileCount = parallelReduce<std::size_t>(pool, *rootDir, 0,
+        [](const FilesystemComponent& c) -> std::size_t { return c.asDirectory() ? 0 : 1; }, plus);
+    std::size_t readmeCount = parallelReduce<std::size_t>(pool, *rootDir, 0,
+        [](const FilesystemComponent& c) -> std::size_t {
+            return c.getName().find("Readme") != std::string::npos ? 1 : 0;
+        }, plus);
+    std::cout << "Parallel reduction: " << fileCount << " files, "
+              << readmeCount << " named like Readme" << std::endl;
+    std::cout << std::endl;
+
+    // Search in parallel by glob, or by predicate; matches are printed as they are found
+    auto printMatch = [](const std::shared_ptr<FilesystemComponent>& match) {
+        std::cout << "  " << match->getName() << std::endl;
+    };
+    std::cout << "Search for *.txt:" << std::endl;
+    searchTree(pool, *rootDir, SearchQuery::glob("*.txt"), printMatch);
+    std::cout << "Search for files over 10000 bytes:" << std::endl;
+    searchTree(pool, *rootDir, SearchQuery::matching([](const FilesystemComponent& c) {
+        return c.asDirectory() == nullptr && c.totalBytes() > 10000;
+    }), printMatch);
+    std::cout << std::endl;
+
+    // Build the same hierarchy in the compact arena-backed form
+    FlatFilesystem flat;
+    auto flatRoot = flat.createDirectory("Root");
+    auto flatDocs = flat.createDirectory("Documents");
+    auto flatPhotos = flat.createDirectory("Photos");
+    flat.add(flatDocs, flat.createFile("Document.txt", 12000));
+    flat.add(flatPhotos, flat.createFile("Presentation.pptx", 860000));
+    flat.add(flatRoot, flatDocs);
+    flat.add(flatRoot, flatPhotos);
+    flat.add(flatRoot, flat.createFile("Readme.txt", 1500));
+    std::cout << "Flat (arena-backed) Filesystem Structure:" << std::endl;
+    flat.showDetails(flatRoot);
+    std::cout << std::endl;
+
+    // One batched visitor, run over both the pointer tree and the flat form
+    for (int form = 0; form < 2; ++form) {
+        SizeSummary summary;
+        if (form == 0) {
+            visitBatched(*rootDir, summary);
+        } else {
+            visitBatched(flat, flatRoot, summary);
+        }
+        std::cout << "Batched visit (" << (form == 0 ? "pointer tree" : "flat form") << "): "
+                  << summary.files << " files, " << summary.directories << " directories, "
+                  << summary.bytes << " bytes, largest " << summary.largest << std::endl;
+    }
+    std::cout << std::endl;
+
+    // Where the memory of each form goes, and how many nodes are alive in the process
+    std::cout << "Memory of the pointer tree: ";
+    measureMemory(*rootDir).print(std::cout);
+    std::cout << "Memory of the flat form: ";
+    measureMemory(flat).print(std::cout);
+    std::cout << "Live nodes: " << FilesystemComponent::liveCount(FilesystemComponent::Kind::File)
+              << " files, " << FilesystemComponent::liveCount(FilesystemComponent::Kind::Directory)
+              << " directories" << std::endl;
+    std::cout << std::endl;
+
+    // Persistent versions: each change publishes a new root that shares every untouched
+    // subtree, while a reader keeps whichever version it took
+    PersistentFilesystem versions(PersistentNode::copyOf(*rootDir));
+    PersistentNode::Ptr before = versions.snapshot();
+    versions.add("Photos", PersistentNode::file("Holiday.jpg", 3100000));
+    versions.remove("Readme.txt");
+    PersistentNode::Ptr after = versions.snapshot();
+    std::cout << "Snapshot taken before the edits:" << std::endl;
+    before->showDetails();
+    std::cout << "Snapshot after adding Photos/Holiday.jpg and removing Readme.txt:" << std::endl;
+    after->showDetails();
+    std::cout << "Documents shared by both versions: "
+              << (before->find("Documents") == after->find("Documents") ? "yes" : "no") << std::endl;
+    std::cout << std::endl;
+
+    // Save the tree, browse the saved copy in place through a memory mapping, and only
+    // materialize a mutable tree to edit it
+    const std::string treeFile = (std::filesystem::temp_directory_path() / "composite-demo.tree").string();
+    MappedTree mapped;
+    if (writeTreeFile(*rootDir, treeFile) && mapped.open(treeFile)) {
+        std::cout << "Mapped tree file (" << mapped.size() << " nodes):" << std::endl;
+        mapped.showDetails(mapped.root());
+        MappedTree::NodeId slides = mapped.resolve(mapped.root(), "Photos/Presentation.pptx");
+        if (slides != MappedTree::npos) {
+            std::cout << "Resolved in place: Photos/Presentation.pptx -> " << mapped.bytes(slides)
+                      << " bytes" << std::endl;
+        }
+        if (auto copy = std::dynamic_pointer_cast<Directory>(mapped.materialize())) {
+            copy->add(std::make_shared<File>("Notes.txt", 300));
+            std::cout << "Materialized copy after adding Notes.txt: " << copy->fileCount()
+                      << " files, " << copy->totalBytes() << " bytes" << std::endl;
+        }
+        mapped.close();
+    }
+    std::filesystem::remove(treeFile);
+    std::cout << std::endl;
+
     // Clean up is handled by smart pointers
     return 0;
 }
\ No newline at end of file
@@ -9,29 +9,227 @@
  * This demonstrates how the Decorator pattern allows you to add responsibilities to objects
  * dynamically and transparently, without affecting other objects of the same class.
  * Each decorator wraps a Coffee object and adds its own behavior (description and cost).
+ *
+ * Every layer also reports what it adds on its own (layerName/layerCents) and the coffee
+ * it wraps (inner), so a chain can be evaluated in one flat pass. CachedCoffee uses that
+ * to compute a chain's description and cost once; rewrapping any decorator bumps a shared
+ * generation counter, and publishing new prices bumps the table version, either of which
+ * makes cached results recompute on their next query.
+ *
+ * Fixed recipes can skip the runtime chain entirely: Decorated<SimpleCoffee, Milk, Sugar>
+ * prices itself with one fold over the price table and concatenates the description at
+ * compile time, while still being a Coffee that runtime decorators can wrap.
+ *
+ * Drinks configured at runtime can use Drink instead of a linked chain: a base id plus an
+ * inline array of add-on ids in one 64-byte object, priced by table lookup and described
+ * in a single pass.
+ *
+ * For batch runs, OrderBatch stores orders column-wise (base ids plus one count column per
+ * add-on) and prices them with straight multiply-add loops that the compiler vectorizes.
+ * "make bench" compares its throughput with pricing each virtual chain.
+ *
+ * CoffeeFactory hash-conses chains the way a flyweight factory shares objects: each layer
+ * is keyed by the node it wraps plus its add-on, so identical recipes (and common prefixes)
+ * share one immutable chain whose description is built once.
+ *
+ * A short-lived order can place its layers in its own CoffeeArena through makeCoffee();
+ * the chain is still a std::shared_ptr<Coffee>, and the arena rewinds in one step once its
+ * last layer is released. Orders that overlap in time can share CoffeeArena::forThread(),
+ * a per-thread pool that reuses freed layers.
+ *
+ * Decorator chains are evaluated without recursion: CoffeeDecorator walks down through
+ * inner() once and then works outwards from the innermost layer, so chains thousands of
+ * layers deep neither overflow the stack nor rebuild the description at every level.
+ * Tearing a deep chain down is iterative as well.
+ *
+ * Every price comes from a PriceTable in integer cents; cost() is the current table's
+ * price converted to dollars, so the double and cents APIs always agree. The compiled-in
+ * prices only seed the first table. PriceList::reload() parses "Label=cents" lines and
+ * publishes a new table with one atomic pointer store; readers take the current table with
+ * a single load and price a whole chain or batch from that one version.
+ *
+ * "make bench" also writes depth-scaling.csv: build, cost() and getDescription() latency and
+ * heap allocations per operation for chain depths from 1 to 10000, one row per
+ * representation, depth and operation.
  */
 
 #include <iostream>
 #include <string>
 #include <memory>
+#include <vector>
+#include <atomic>
+#include <array>
+#include <string_view>
+#include <cstdint>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <memory_resource>
+#include <cstddef>
+#include <sstream>
+#include <charconv>
+#include <cstdlib>
+#include <new>
+
+// Prices in integer cents
+using Cents = std::int64_t;
+
+// Ids of menu items; each indexes its menu and price tables
+enum class BaseId : std::uint8_t { Simple };
+enum class AddOnId : std::uint8_t { Milk, Sugar, WhippedCream };
+inline constexpr std::size_t kBaseCount = 1;
+inline constexpr std::size_t kAddOnCount = 3;
+
+// One version of the menu prices; never modified once published
+struct PriceTable {
+    std::uint64_t version = 0;
+    std::array<Cents, kBaseCount> bases{};
+    std::array<Cents, kAddOnCount> addOns{};
+
+    Cents base(BaseId id) const { return bases[static_cast<std::size_t>(id)]; }
+    Cents addOn(AddOnId id) const { return addOns[static_cast<std::size_t>(id)]; }
+};
+
+constexpr Cents toCents(double dollars) {
+    return static_cast<Cents>(dollars * 100 + 0.5);
+}
+
+constexpr double toDollars(Cents cents) {
+    return static_cast<double>(cents) / 100;
+}
+
+// The published price table (PriceList::current(), defined below). Every price,
+// in cents or in dollars, is read from it.
+inline const PriceTable& currentPrices();
 
 // Component interface: Coffee
 class Coffee {
 public:
     virtual ~Coffee() = default;
     virtual std::string getDescription() const = 0;
+    // Price in dollars from the current price table
     virtual double cost() const = 0;
+
+    // What this layer contributes by itself; null name means it adds nothing
+    virtual const char* layerName() const = 0;
+    // Price of this layer alone in the given table
+    virtual Cents layerCents(const PriceTable& table) const = 0;
+    double layerCost() const { return toDollars(layerCents(currentPrices())); }
+    // The wrapped coffee, or null for a concrete component
+    virtual const Coffee* inner() const { return nullptr; }
+};
+
+// A chain's layers, collected outermost first by following inner(); short
+// chains stay in an inline buffer
+class ChainLayers {
+public:
+    explicit ChainLayers(const Coffee& top) {
+        for (const Coffee* layer = &top; layer; layer = layer->inner()) {
+            if (inlineCount < kInline) {
+                inlineLayers[inlineCount++] = layer;
+            } else {
+                spill.push_back(layer);
+            }
+        }
+    }
+
+    // Visits the layers from the innermost outwards, the order in which a
+    // recursive evaluation combines them
+    template <typename Fn>
+    void forEachInnermostFirst(Fn&& fn) const {
+        for (std::size_t i = spill.size(); i-- > 0;) {
+            fn(*spill[i]);
+        }
+        for (std::size_t i = inlineCount; i-- > 0;) {
+            fn(*inlineLayers[i]);
+        }
+    }
+
+private:
+    static constexpr std::size_t kInline = 32;
+    std::array<const Coffee*, kInline> inlineLayers;
+    std::size_t inlineCount = 0;
+    std::vector<const Coffee*> spill;
 };
 
+// Sums layer prices from one table, so a chain is priced from a single version
+inline Cents chainCents(const ChainLayers& layers, const PriceTable& table) {
+    Cents total = 0;
+    layers.forEachInnermostFirst([&total, &table](const Coffee& layer) { total += layer.layerCents(table); });
+    return total;
+}
+
+// A chain's price in dollars, summed exactly in cents from the current table
+inline double chainCost(const ChainLayers& layers) {
+    return toDollars(chainCents(layers, currentPrices()));
+}
+
+// Joins layer names with ", " into a buffer sized up front
+inline std::string chainDescription(const ChainLayers& layers) {
+    std::size_t length = 0;
+    layers.forEachInnermostFirst([&length](const Coffee& layer) {
+        if (const char* name = layer.layerName()) {
+            length += std::char_traits<char>::length(name) + 2;
+        }
+    });
+    std::string description;
+    description.reserve(length);
+    bool first = true;
+    layers.forEachInnermostFirst([&description, &first](const Coffee& layer) {
+        if (const char* name = layer.layerName()) {
+            if (!first) {
+                description += ", ";
+            }
+            description += name;
+            first = false;
+        }
+    });
+    return description;
+}
+
+// Evaluates a chain's description and price from a single walk of its layers
+inline void evaluateChain(const Coffee& coffee, const PriceTable& table, std::string& description, Cents& total) {
+    ChainLayers layers(coffee);
+    description = chainDescription(layers);
+    total = chainCents(layers, table);
+}
+
 // Concrete Component: SimpleCoffee
 class SimpleCoffee : public Coffee {
 public:
+    static constexpr BaseId id = BaseId::Simple;
+    static constexpr std::string_view label = "Simple Coffee";
+    static constexpr double price = 2.0; // Launch price; seeds the default price table
+
     std::string getDescription() const override {
-        return "Simple Coffee";
+        return std::string(label);
     }
     double cost() const override {
-        return 2.0; // Base price of simple coffee
+        return layerCost();
     }
+    const char* layerName() const override { return label.data(); }
+    Cents layerCents(const PriceTable& table) const override { return table.base(id); }
+};
+
+// Add-ons: the label shared by the runtime decorators and by compile-time
+// recipes, and the launch price the default price table starts from
+struct Milk {
+    static constexpr AddOnId id = AddOnId::Milk;
+    static constexpr std::string_view label = "Milk";
+    static constexpr double price = 0.5;
+};
+struct Sugar {
+    static constexpr AddOnId id = AddOnId::Sugar;
+    static constexpr std::string_view label = "Sugar";
+    static constexpr double price = 0.2;
+};
+struct WhippedCream {
+    static constexpr AddOnId id = AddOnId::WhippedCream;
+    static constexpr std::string_view label = "Whipped Cream";
+    static constexpr double price = 1.0;
 };
 
 // Decorator base class: CoffeeDecorator
@@ -40,51 +238,874 @@ protected:
     std::shared_ptr<Coffee> coffee;
 public:
     explicit CoffeeDecorator(std::shared_ptr<Coffee> c) : coffee(std::move(c)) {}
-    std::string getDescription() const override {
-        return coffee->getDescription();
+
+    // Releases the wrapped chain iteratively: a nested decorator destructor
+    // hands its inner coffee to the outermost one on this thread and returns
+    ~CoffeeDecorator() override {
+        static thread_local std::vector<std::shared_ptr<Coffee>>* teardown = nullptr;
+        if (!teardown && (!coffee || !coffee->inner())) {
+            return; // Nothing nested below: the member destructor is enough
+        }
+        if (teardown) {
+            teardown->push_back(std::move(coffee));
+            return;
+        }
+        std::vector<std::shared_ptr<Coffee>> doomed;
+        teardown = &doomed;
+        doomed.push_back(std::move(coffee));
+        while (!doomed.empty()) {
+            std::shared_ptr<Coffee> layer = std::move(doomed.back());
+            doomed.pop_back();
+            layer.reset();
+        }
+        teardown = nullptr;
     }
-    double cost() const override {
-        return coffee->cost();
+
+    // Decorators describe themselves through layerName/layerCost; the chain
+    // is then evaluated without recursion
+    std::string getDescription() const final {
+        return chainDescription(ChainLayers(*this));
     }
+    double cost() const final {
+        return chainCost(ChainLayers(*this));
+    }
+    const char* layerName() const override { return nullptr; }
+    Cents layerCents(const PriceTable&) const override { return 0; }
+    const Coffee* inner() const override { return coffee.get(); }
+
+    // Replaces the wrapped coffee and invalidates every cached evaluation.
+    // Returns false, changing nothing, if `c` already contains this layer:
+    // the chain would loop and keep itself alive. Not synchronized: an
+    // evaluation on another thread holds raw pointers to the old layers, so
+    // rewrap needs exclusive access to the chain.
+    bool rewrap(std::shared_ptr<Coffee> c) {
+        for (const Coffee* layer = c.get(); layer; layer = layer->inner()) {
+            if (layer == this) {
+                return false;
+            }
+        }
+        coffee = std::move(c);
+        generation.fetch_add(1, std::memory_order_release);
+        return true;
+    }
+    static unsigned long chainGeneration() {
+        return generation.load(std::memory_order_acquire);
+    }
+
+private:
+    static std::atomic<unsigned long> generation;
 };
 
+std::atomic<unsigned long> CoffeeDecorator::generation(0);
+
 // Concrete Decorator: MilkDecorator
 class MilkDecorator : public CoffeeDecorator {
 public:
     explicit MilkDecorator(std::shared_ptr<Coffee> c) : CoffeeDecorator(std::move(c)) {}
-    std::string getDescription() const override {
-        return coffee->getDescription() + ", Milk";
-    }
-    double cost() const override {
-        return coffee->cost() + 0.5; // Adding cost of milk
-    }
+    const char* layerName() const override { return Milk::label.data(); }
+    Cents layerCents(const PriceTable& table) const override { return table.addOn(Milk::id); } // Adding cost of milk
 };
 
 // Concrete Decorator: SugarDecorator
 class SugarDecorator : public CoffeeDecorator {
 public:
     explicit SugarDecorator(std::shared_ptr<Coffee> c) : CoffeeDecorator(std::move(c)) {}
+    const char* layerName() const override { return Sugar::label.data(); }
+    Cents layerCents(const PriceTable& table) const override { return table.addOn(Sugar::id); } // Adding cost of sugar
+};
+
+// Concrete Decorator: WhippedCreamDecorator
+class WhippedCreamDecorator : public CoffeeDecorator {
+public:
+    explicit WhippedCreamDecorator(std::shared_ptr<Coffee> c) : CoffeeDecorator(std::move(c)) {}
+    const char* layerName() const override { return WhippedCream::label.data(); }
+    Cents layerCents(const PriceTable& table) const override { return table.addOn(WhippedCream::id); } // Adding cost of whipped cream
+};
+
+// Caches a chain's description and cost; repeat queries are O(1) until some
+// decorator is rewrapped or new prices are published. Not thread-safe: keep
+// one per order or per thread.
+class CachedCoffee : public Coffee {
+    std::shared_ptr<Coffee> coffee;
+    mutable std::string description;
+    mutable Cents total = 0;
+    mutable unsigned long seenGeneration = 0;
+    mutable std::uint64_t seenPrices = 0;
+    mutable bool valid = false;
+
+    void refresh() const {
+        unsigned long current = CoffeeDecorator::chainGeneration();
+        const PriceTable& prices = currentPrices();
+        if (valid && seenGeneration == current && seenPrices == prices.version) {
+            return;
+        }
+        evaluateChain(*coffee, prices, description, total);
+        seenGeneration = current;
+        seenPrices = prices.version;
+        valid = true;
+    }
+
+public:
+    explicit CachedCoffee(std::shared_ptr<Coffee> c) : coffee(std::move(c)) {}
     std::string getDescription() const override {
-        return coffee->getDescription() + ", Sugar";
+        return cachedDescription();
     }
     double cost() const override {
-        return coffee->cost() + 0.2; // Adding cost of sugar
+        refresh();
+        return toDollars(total);
+    }
+    // Avoids the copy getDescription() has to make
+    const std::string& cachedDescription() const {
+        refresh();
+        return description;
     }
+    const char* layerName() const override { return nullptr; }
+    Cents layerCents(const PriceTable&) const override { return 0; }
+    const Coffee* inner() const override { return coffee.get(); }
 };
 
-// Concrete Decorator: WhippedCreamDecorator
-class WhippedCreamDecorator : public CoffeeDecorator {
+// Compile-time decorator stack: a fixed recipe whose description is built
+// once, at compile time, and whose price is one fold over the price table
+template <typename Base, typename... AddOns>
+class Decorated final : public Coffee {
+    static constexpr std::size_t length =
+        Base::label.size() + (std::size_t{0} + ... + (AddOns::label.size() + 2));
+
+    static constexpr std::array<char, length + 1> buildText() {
+        std::array<char, length + 1> text{};
+        std::size_t pos = 0;
+        auto append = [&text, &pos](std::string_view part) {
+            for (char c : part) {
+                text[pos++] = c;
+            }
+        };
+        append(Base::label);
+        ((append(", "), append(AddOns::label)), ...);
+        return text;
+    }
+
+    static constexpr std::array<char, length + 1> text = buildText();
+
 public:
-    explicit WhippedCreamDecorator(std::shared_ptr<Coffee> c) : CoffeeDecorator(std::move(c)) {}
+    static constexpr std::string_view label{text.data(), length};
+
     std::string getDescription() const override {
-        return coffee->getDescription() + ", Whipped Cream";
+        return std::string(label);
     }
     double cost() const override {
-        return coffee->cost() + 1.0; // Adding cost of whipped cream
+        return layerCost();
+    }
+    const char* layerName() const override { return text.data(); }
+    Cents layerCents(const PriceTable& table) const override {
+        return (table.base(Base::id) + ... + table.addOn(AddOns::id));
     }
 };
 
-int main() {
+// Bump-pointer arena for decorator layers. Counts live allocations and
+// rewinds to its initial buffer when the last one is freed, so a whole
+// order's chain is released at once. Freed layers are not reused before
+// that, so use one arena per order: an arena shared by orders that
+// overlap in time never rewinds and grows with every layer built in it.
+// Orders that overlap should use forThread() instead. Not thread-safe:
+// build and drop chains on the thread that owns the arena, and let them
+// die before it.
+class CoffeeArena : public std::pmr::memory_resource {
+public:
+    explicit CoffeeArena(std::size_t initialBytes = 1024)
+        : buffer(initialBytes),
+          pool(buffer.data(), buffer.size(), std::pmr::new_delete_resource()) {}
+
+    CoffeeArena(const CoffeeArena&) = delete;
+    CoffeeArena& operator=(const CoffeeArena&) = delete;
+
+    std::size_t liveAllocations() const { return live; }
+
+    // Per-thread resource for orders whose lifetimes overlap. Freed layers
+    // go back to per-size pools and are reused, so a thread that always
+    // keeps some order alive stays at its peak number of live layers
+    // instead of growing. Chains must die before their thread exits.
+    static std::pmr::memory_resource* forThread() {
+        thread_local std::pmr::unsynchronized_pool_resource pool;
+        return &pool;
+    }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void* memory = pool.allocate(bytes, alignment);
+        ++live;
+        return memory;
+    }
+    void do_deallocate(void*, std::size_t, std::size_t) override {
+        if (--live == 0) {
+            pool.release();
+        }
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+    std::vector<std::byte> buffer;
+    std::pmr::monotonic_buffer_resource pool;
+    std::size_t live = 0;
+};
+
+// Creates a coffee layer with make_shared, or inside an arena when one is
+// given; callers get a std::shared_ptr<Coffee> either way
+template <typename T, typename... Args>
+std::shared_ptr<Coffee> makeCoffee(std::pmr::memory_resource* arena, Args&&... args) {
+    if (!arena) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+    return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(arena), std::forward<Args>(args)...);
+}
+
+// Wraps a coffee in the decorator for an add-on
+inline std::shared_ptr<Coffee> wrapAddOn(std::shared_ptr<Coffee> coffee, AddOnId addOn,
+                                         std::pmr::memory_resource* arena = nullptr) {
+    switch (addOn) {
+    case AddOnId::Milk:
+        return makeCoffee<MilkDecorator>(arena, std::move(coffee));
+    case AddOnId::Sugar:
+        return makeCoffee<SugarDecorator>(arena, std::move(coffee));
+    case AddOnId::WhippedCream:
+        return makeCoffee<WhippedCreamDecorator>(arena, std::move(coffee));
+    }
+    return coffee;
+}
+
+// Menu entries for data-driven drinks, indexed by BaseId and AddOnId. The
+// launch prices only seed version 0 of the price table; the live prices
+// are always read from PriceList.
+struct MenuItem {
+    std::string_view label;
+    double launchPrice;
+};
+
+inline constexpr std::array<MenuItem, kBaseCount> baseMenu{{
+    {SimpleCoffee::label, SimpleCoffee::price},
+}};
+inline constexpr std::array<MenuItem, kAddOnCount> addOnMenu{{
+    {Milk::label, Milk::price},
+    {Sugar::label, Sugar::price},
+    {WhippedCream::label, WhippedCream::price},
+}};
+
+// Publishes price tables for hot reload. Readers get the current table with
+// one acquire load and no locks; published tables are never modified or
+// freed, so a reader can keep pricing from the version it loaded.
+class PriceList {
+public:
+    static const PriceTable& current() {
+        return *active.load(std::memory_order_acquire);
+    }
+
+    // Installs a new table atomically and returns its version
+    static std::uint64_t publish(PriceTable table) {
+        std::lock_guard<std::mutex> lock(writer);
+        return publishLocked(table);
+    }
+
+    // Applies "Label=cents" lines on top of the current table; blank lines
+    // and lines starting with '#' are skipped. Whitespace (including a CRLF
+    // '\r') around the line, the label and the price is ignored. Nothing is
+    // published unless every line names a menu item and a non-negative price.
+    static bool reload(std::istream& in) {
+        std::lock_guard<std::mutex> lock(writer);
+        PriceTable table = current();
+        std::string buffer;
+        while (std::getline(in, buffer)) {
+            std::string_view line = trim(buffer);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::size_t separator = line.find('=');
+            if (separator == std::string_view::npos) {
+                return false;
+            }
+            std::string_view price = trim(line.substr(separator + 1));
+            Cents cents = 0;
+            const char* first = price.data();
+            const char* last = price.data() + price.size();
+            auto parsed = std::from_chars(first, last, cents);
+            if (parsed.ec != std::errc() || parsed.ptr != last || first == last || cents < 0) {
+                return false;
+            }
+            if (!setPrice(table, trim(line.substr(0, separator)), cents)) {
+                return false;
+            }
+        }
+        publishLocked(table);
+        return true;
+    }
+
+private:
+    static std::string_view trim(std::string_view text) {
+        const char* whitespace = " \t\r\n\f\v";
+        std::size_t begin = text.find_first_not_of(whitespace);
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        return text.substr(begin, text.find_last_not_of(whitespace) - begin + 1);
+    }
+
+    static std::uint64_t publishLocked(PriceTable& table) {
+        table.version = current().version + 1;
+        history.push_back(std::make_unique<const PriceTable>(table));
+        active.store(history.back().get(), std::memory_order_release);
+        return table.version;
+    }
+
+    static bool setPrice(PriceTable& table, std::string_view label, Cents cents) {
+        for (std::size_t i = 0; i < baseMenu.size(); ++i) {
+            if (baseMenu[i].label == label) {
+                table.bases[i] = cents;
+                return true;
+            }
+        }
+        for (std::size_t i = 0; i < addOnMenu.size(); ++i) {
+            if (addOnMenu[i].label == label) {
+                table.addOns[i] = cents;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Version 0 comes from the compiled-in menu prices
+    static PriceTable defaults() {
+        PriceTable table;
+        for (std::size_t i = 0; i < baseMenu.size(); ++i) {
+            table.bases[i] = toCents(baseMenu[i].launchPrice);
+        }
+        for (std::size_t i = 0; i < addOnMenu.size(); ++i) {
+            table.addOns[i] = toCents(addOnMenu[i].launchPrice);
+        }
+        return table;
+    }
+
+    static inline const PriceTable initial = defaults();
+    static inline std::atomic<const PriceTable*> active{&initial};
+    static inline std::mutex writer;
+    static inline std::vector<std::unique_ptr<const PriceTable>> history;
+};
+
+inline const PriceTable& currentPrices() {
+    return PriceList::current();
+}
+
+#ifdef DECORATOR_COUNT_ALLOCATIONS
+// Bench builds count every plain heap allocation the program makes
+std::atomic<std::uint64_t> allocationCount{0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+// GCC flags free() on memory from operator new once both are inlined, not
+// knowing that this file replaces operator new with malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// Prices a chain in cents from one table version, the current one by default
+inline Cents priceInCents(const Coffee& coffee, const PriceTable& table = PriceList::current()) {
+    return chainCents(ChainLayers(coffee), table);
+}
+
+// Formats cents as dollars, e.g. 370 as "$3.70"
+inline std::string formatCents(Cents cents) {
+    std::string text = cents < 0 ? "-$" : "$";
+    Cents magnitude = cents < 0 ? -cents : cents;
+    text += std::to_string(magnitude / 100);
+    text += '.';
+    text += static_cast<char>('0' + magnitude % 100 / 10);
+    text += static_cast<char>('0' + magnitude % 10);
+    return text;
+}
+
+// A decorated drink as a base coffee plus up to kMaxAddOns add-on ids,
+// stored inline in a single cache line instead of a chain of heap objects
+class alignas(64) Drink {
+public:
+    static constexpr std::size_t kMaxAddOns = 62;
+
+    explicit Drink(BaseId b = BaseId::Simple) : base(b) {}
+
+    // Returns false once the drink is full
+    bool add(AddOnId id) {
+        if (count == kMaxAddOns) {
+            return false;
+        }
+        addOns[count++] = id;
+        return true;
+    }
+    std::size_t size() const { return count; }
+    BaseId baseId() const { return base; }
+    AddOnId addOnAt(std::size_t index) const { return addOns[index]; }
+
+    double cost() const {
+        return toDollars(costCents());
+    }
+
+    Cents costCents(const PriceTable& table = PriceList::current()) const {
+        Cents total = table.base(base);
+        for (std::size_t i = 0; i < count; ++i) {
+            total += table.addOn(addOns[i]);
+        }
+        return total;
+    }
+
+    std::string getDescription() const {
+        std::string_view baseLabel = baseMenu[static_cast<std::size_t>(base)].label;
+        std::size_t length = baseLabel.size();
+        for (std::size_t i = 0; i < count; ++i) {
+            length += addOnMenu[static_cast<std::size_t>(addOns[i])].label.size() + 2;
+        }
+        std::string description;
+        description.reserve(length);
+        description += baseLabel;
+        for (std::size_t i = 0; i < count; ++i) {
+            description += ", ";
+            description += addOnMenu[static_cast<std::size_t>(addOns[i])].label;
+        }
+        return description;
+    }
+
+    // Builds the equivalent runtime decorator chain, optionally in an arena
+    std::shared_ptr<Coffee> toCoffee(std::pmr::memory_resource* arena = nullptr) const {
+        std::shared_ptr<Coffee> coffee = makeCoffee<SimpleCoffee>(arena);
+        for (std::size_t i = 0; i < count; ++i) {
+            coffee = wrapAddOn(std::move(coffee), addOns[i], arena);
+        }
+        return coffee;
+    }
+
+private:
+    BaseId base;
+    std::uint8_t count = 0;
+    AddOnId addOns[kMaxAddOns] = {};
+};
+
+static_assert(sizeof(Drink) == 64, "Drink must fit in one cache line");
+
+// Orders stored column-wise for bulk pricing: a base column and one count
+// column per add-on. Totals match the chains up to floating-point rounding,
+// since repeated add-ons are multiplied rather than added one by one.
+class OrderBatch {
+public:
+    void reserve(std::size_t orders) {
+        bases.reserve(orders);
+        for (auto& column : counts) {
+            column.reserve(orders);
+        }
+    }
+
+    void add(const Drink& drink) {
+        bases.push_back(drink.baseId());
+        for (auto& column : counts) {
+            column.push_back(0);
+        }
+        for (std::size_t i = 0; i < drink.size(); ++i) {
+            ++counts[static_cast<std::size_t>(drink.addOnAt(i))].back();
+        }
+    }
+
+    std::size_t size() const { return bases.size(); }
+
+    // Prices orders in cache-sized blocks, one pass per column within a
+    // block; the add-on passes are plain multiply-adds over contiguous
+    // arrays so they compile to SIMD code
+    void priceAll(std::vector<double>& totals, const PriceTable& table = PriceList::current()) const {
+        constexpr std::size_t kBlock = 2048;
+        const std::size_t n = bases.size();
+        totals.resize(n);
+        for (std::size_t first = 0; first < n; first += kBlock) {
+            const std::size_t count = std::min(kBlock, n - first);
+            double* out = totals.data() + first;
+            const BaseId* base = bases.data() + first;
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = toDollars(table.base(base[i]));
+            }
+            for (std::size_t k = 0; k < counts.size(); ++k) {
+                const std::uint8_t* column = counts[k].data() + first;
+                const double price = toDollars(table.addOns[k]);
+                for (std::size_t i = 0; i < count; ++i) {
+                    out[i] += column[i] * price;
+                }
+            }
+        }
+    }
+
+    // Same blocked passes in integer cents; exact, and every order in the
+    // batch is priced from the same table version
+    void priceAllCents(std::vector<Cents>& totals, const PriceTable& table = PriceList::current()) const {
+        constexpr std::size_t kBlock = 2048;
+        const std::size_t n = bases.size();
+        totals.resize(n);
+        for (std::size_t first = 0; first < n; first += kBlock) {
+            const std::size_t count = std::min(kBlock, n - first);
+            Cents* out = totals.data() + first;
+            const BaseId* base = bases.data() + first;
+            for (std::size_t i = 0; i < count; ++i) {
+                out[i] = table.base(base[i]);
+            }
+            for (std::size_t k = 0; k < counts.size(); ++k) {
+                const std::uint8_t* column = counts[k].data() + first;
+                const Cents price = table.addOns[k];
+                for (std::size_t i = 0; i < count; ++i) {
+                    out[i] += column[i] * price;
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<BaseId> bases;
+    std::array<std::vector<std::uint8_t>, addOnMenu.size()> counts;
+};
+
+// Immutable chain layer handed out by CoffeeFactory; its description and
+// add-on counts are computed once, from the already-interned inner layer,
+// so pricing it from any table takes one lookup per menu item
+class InternedCoffee final : public Coffee {
+    std::shared_ptr<const InternedCoffee> wrapped;
+    const MenuItem* item;
+    std::string description;
+    std::size_t baseIndex;
+    std::array<std::uint32_t, kAddOnCount> addOnCounts{};
+
+public:
+    InternedCoffee(std::shared_ptr<const InternedCoffee> innerLayer, const MenuItem& menuItem)
+        : wrapped(std::move(innerLayer)), item(&menuItem),
+          description(wrapped ? wrapped->description + ", " : std::string()),
+          baseIndex(wrapped ? wrapped->baseIndex : static_cast<std::size_t>(&menuItem - baseMenu.data())) {
+        description += menuItem.label;
+        if (wrapped) {
+            addOnCounts = wrapped->addOnCounts;
+            ++addOnCounts[item - addOnMenu.data()];
+        }
+    }
+    std::string getDescription() const override { return description; }
+    double cost() const override { return toDollars(chainCents(currentPrices())); }
+    // The whole chain's price in the given table
+    Cents chainCents(const PriceTable& table) const {
+        Cents total = table.bases[baseIndex];
+        for (std::size_t k = 0; k < kAddOnCount; ++k) {
+            total += addOnCounts[k] * table.addOns[k];
+        }
+        return total;
+    }
+    const char* layerName() const override { return item->label.data(); }
+    Cents layerCents(const PriceTable& table) const override {
+        // The innermost layer is a base; every layer above it is an add-on
+        return wrapped ? table.addOns[item - addOnMenu.data()] : table.bases[baseIndex];
+    }
+    const Coffee* inner() const override { return wrapped.get(); }
+
+    const std::string& cachedDescription() const { return description; }
+};
+
+// Canonicalizing factory: identical recipes share one chain, and recipes
+// that start alike share their common prefix
+class CoffeeFactory {
+private:
+    struct Key {
+        const InternedCoffee* inner;
+        AddOnId addOn;
+        bool operator==(const Key& other) const {
+            return inner == other.inner && addOn == other.addOn;
+        }
+    };
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const {
+            return std::hash<const void*>()(key.inner) * 31 + static_cast<std::size_t>(key.addOn);
+        }
+    };
+
+    std::mutex mutex;
+    std::array<std::shared_ptr<const InternedCoffee>, baseMenu.size()> bases;
+    std::unordered_map<Key, std::shared_ptr<const InternedCoffee>, KeyHash> layers;
+    std::size_t requests = 0;
+    std::size_t layersRequested = 0;
+
+public:
+    // Returns the shared chain for a base plus ordered add-ons
+    template <typename It>
+    std::shared_ptr<const Coffee> getCoffee(BaseId base, It firstAddOn, It lastAddOn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++requests;
+        auto& baseLayer = bases[static_cast<std::size_t>(base)];
+        if (!baseLayer) {
+            baseLayer = std::make_shared<InternedCoffee>(nullptr, baseMenu[static_cast<std::size_t>(base)]);
+        }
+        std::shared_ptr<const InternedCoffee> chain = baseLayer;
+        ++layersRequested;
+        for (It it = firstAddOn; it != lastAddOn; ++it) {
+            auto& layer = layers[Key{chain.get(), *it}];
+            if (!layer) {
+                layer = std::make_shared<InternedCoffee>(chain, addOnMenu[static_cast<std::size_t>(*it)]);
+            }
+            chain = layer;
+            ++layersRequested;
+        }
+        return chain;
+    }
+    std::shared_ptr<const Coffee> getCoffee(BaseId base, std::initializer_list<AddOnId> addOns) {
+        return getCoffee(base, addOns.begin(), addOns.end());
+    }
+    std::shared_ptr<const Coffee> getCoffee(const Drink& drink) {
+        std::array<AddOnId, Drink::kMaxAddOns> addOns;
+        for (std::size_t i = 0; i < drink.size(); ++i) {
+            addOns[i] = drink.addOnAt(i);
+        }
+        return getCoffee(drink.baseId(), addOns.begin(), addOns.begin() + drink.size());
+    }
+
+    // Compares the layers requested with the layers actually built; memory
+    // figures count node objects, make_shared control blocks, heap-held
+    // descriptions and hash entries, but not allocator overhead
+    void printStats(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(mutex);
+        const std::size_t controlBlock = sizeof(void*) + 2 * sizeof(int);
+        const std::size_t unique = layers.size() + static_cast<std::size_t>(
+            std::count_if(bases.begin(), bases.end(), [](const auto& b) { return b != nullptr; }));
+        const std::size_t freshBytes = layersRequested * (sizeof(MilkDecorator) + controlBlock);
+        std::size_t internedBytes = layers.bucket_count() * sizeof(void*);
+        auto addLayer = [&](const InternedCoffee& layer) {
+            internedBytes += sizeof(InternedCoffee) + controlBlock;
+            const std::string& text = layer.cachedDescription();
+            if (text.capacity() > std::string().capacity()) {
+                internedBytes += text.capacity() + 1;
+            }
+        };
+        for (const auto& base : bases) {
+            if (base) {
+                addLayer(*base);
+            }
+        }
+        for (const auto& entry : layers) {
+            addLayer(*entry.second);
+            internedBytes += sizeof(Key) + sizeof(entry.second) + 2 * sizeof(void*);
+        }
+        out << requests << " chains, " << layersRequested << " layers requested, " << unique
+            << " built (dedupe ratio " << (unique ? double(layersRequested) / unique : 0.0) << ":1)\n";
+        out << "Memory: " << internedBytes << " bytes shared vs " << freshBytes
+            << " bytes for fresh chains (";
+        if (internedBytes <= freshBytes) {
+            out << freshBytes - internedBytes << " bytes saved)\n";
+        } else {
+            out << internedBytes - freshBytes << " bytes extra)\n";
+        }
+    }
+};
+
+// Prices the same random orders as virtual chains, Drinks and an OrderBatch.
+// Orders are generated and priced in chunks of kChunk, so memory stays at a
+// few hundred bytes per chunk order however many orders are requested; each
+// chunk is still far larger than the caches, so the chains are priced cold.
+int runPricingBenchmark(std::size_t orderCount) {
+    using Clock = std::chrono::steady_clock;
+    constexpr std::size_t kChunk = std::size_t(1) << 18;
+    auto seconds = [](Clock::duration d) { return std::chrono::duration<double>(d).count(); };
+    auto report = [&](const char* name, Clock::duration d, double checksum) {
+        double s = seconds(d);
+        std::cout << name << orderCount / s << " orders/s (" << s << " s, checksum " << checksum << ")" << std::endl;
+    };
+
+    std::mt19937 rng(42);
+    Clock::duration chainTime{}, drinkTime{}, batchTime{}, centsTime{};
+    double chainSum = 0.0, drinkSum = 0.0, batchSum = 0.0, maxError = 0.0;
+    Cents centsSum = 0;
+    std::vector<Drink> drinks;
+    std::vector<std::shared_ptr<Coffee>> chains;
+    std::vector<double> totals;
+    std::vector<Cents> cents;
+    for (std::size_t first = 0; first < orderCount; first += kChunk) {
+        const std::size_t count = std::min(kChunk, orderCount - first);
+        drinks.assign(count, Drink());
+        for (Drink& drink : drinks) {
+            std::size_t addOns = rng() % 9;
+            for (std::size_t i = 0; i < addOns; ++i) {
+                drink.add(static_cast<AddOnId>(rng() % addOnMenu.size()));
+            }
+        }
+        chains.clear();
+        OrderBatch batch;
+        batch.reserve(count);
+        for (const Drink& drink : drinks) {
+            chains.push_back(drink.toCoffee());
+            batch.add(drink);
+        }
+
+        auto start = Clock::now();
+        for (const auto& chain : chains) {
+            chainSum += chain->cost();
+        }
+        chainTime += Clock::now() - start;
+
+        start = Clock::now();
+        for (const Drink& drink : drinks) {
+            drinkSum += drink.cost();
+        }
+        drinkTime += Clock::now() - start;
+
+        start = Clock::now();
+        batch.priceAll(totals);
+        batchTime += Clock::now() - start;
+        for (std::size_t i = 0; i < count; ++i) {
+            batchSum += totals[i];
+            maxError = std::max(maxError, std::fabs(totals[i] - drinks[i].cost()));
+        }
+
+        start = Clock::now();
+        batch.priceAllCents(cents);
+        centsTime += Clock::now() - start;
+        for (Cents total : cents) {
+            centsSum += total;
+        }
+    }
+
+    report("Virtual chains:     ", chainTime, chainSum);
+    report("Drink opcodes:      ", drinkTime, drinkSum);
+    report("OrderBatch:         ", batchTime, batchSum);
+    std::cout << "Largest difference from the chains: " << maxError << std::endl;
+    report("OrderBatch (cents): ", centsTime, static_cast<double>(centsSum) / 100);
+    return 0;
+}
+
+// Times one operation and writes its CSV row; allocations are left empty
+// unless the build counts them
+template <typename Op>
+void measureDepthOp(std::ostream& csv, const char* representation, std::size_t depth,
+                    const char* operation, std::size_t reps, Op op) {
+    using Clock = std::chrono::steady_clock;
+    static volatile double sink = 0.0;
+    sink = sink + op();
+#ifdef DECORATOR_COUNT_ALLOCATIONS
+    const std::uint64_t allocationsBefore = allocationCount.load(std::memory_order_relaxed);
+#endif
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < reps; ++i) {
+        sink = sink + op();
+    }
+    const double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    csv << representation << ',' << depth << ',' << operation << ',' << nanoseconds / reps << ',';
+#ifdef DECORATOR_COUNT_ALLOCATIONS
+    csv << static_cast<double>(allocationCount.load(std::memory_order_relaxed) - allocationsBefore) / reps;
+#endif
+    csv << '\n';
+}
+
+// Measures build, cost() and getDescription() per representation for
+// depths 1, 2, 5, 10, ... up to maxDepth. Representations that cannot hold
+// a depth (Drink beyond its inline capacity) or would be unreasonably
+// large (interned chains keep every prefix's description) are skipped.
+int runDepthBenchmark(std::size_t maxDepth) {
+    std::ostream& csv = std::cout;
+    csv << "representation,depth,operation,ns_per_op,allocations_per_op\n";
+
+    std::vector<std::size_t> depths;
+    for (std::size_t scale = 1; scale <= maxDepth; scale *= 10) {
+        for (std::size_t step : {1, 2, 5}) {
+            if (scale * step <= maxDepth) {
+                depths.push_back(scale * step);
+            }
+        }
+    }
+
+    for (std::size_t depth : depths) {
+        const std::size_t reps = std::max<std::size_t>(20, 200000 / depth);
+        std::vector<AddOnId> addOns(depth);
+        for (std::size_t i = 0; i < depth; ++i) {
+            addOns[i] = static_cast<AddOnId>(i % kAddOnCount);
+        }
+        auto buildChain = [&addOns](std::pmr::memory_resource* arena) {
+            std::shared_ptr<Coffee> coffee = makeCoffee<SimpleCoffee>(arena);
+            for (AddOnId addOn : addOns) {
+                coffee = wrapAddOn(std::move(coffee), addOn, arena);
+            }
+            return coffee;
+        };
+
+        // Heap-allocated shared_ptr chain with virtual layers
+        std::shared_ptr<Coffee> chain = buildChain(nullptr);
+        measureDepthOp(csv, "virtual", depth, "build", reps, [&] { return buildChain(nullptr)->layerCost(); });
+        measureDepthOp(csv, "virtual", depth, "cost", reps, [&] { return chain->cost(); });
+        measureDepthOp(csv, "virtual", depth, "description", reps,
+                       [&] { return static_cast<double>(chain->getDescription().size()); });
+
+        // Same chain with its layers in a CoffeeArena
+        CoffeeArena arena(64 * 1024);
+        {
+            std::shared_ptr<Coffee> arenaChain = buildChain(&arena);
+            measureDepthOp(csv, "arena", depth, "build", reps, [&] { return buildChain(&arena)->layerCost(); });
+            measureDepthOp(csv, "arena", depth, "cost", reps, [&] { return arenaChain->cost(); });
+            measureDepthOp(csv, "arena", depth, "description", reps,
+                           [&] { return static_cast<double>(arenaChain->getDescription().size()); });
+        }
+
+        // CachedCoffee over the heap chain: repeat queries
+        CachedCoffee cached(chain);
+        measureDepthOp(csv, "cached", depth, "build", reps,
+                       [&] { return CachedCoffee(chain).cost(); });
+        measureDepthOp(csv, "cached", depth, "cost", reps, [&] { return cached.cost(); });
+        measureDepthOp(csv, "cached", depth, "description", reps,
+                       [&] { return static_cast<double>(cached.getDescription().size()); });
+
+        // Hash-consed chain: build is a lookup of an already-interned recipe
+        if (depth <= 1000) {
+            CoffeeFactory factory;
+            auto interned = factory.getCoffee(BaseId::Simple, addOns.begin(), addOns.end());
+            measureDepthOp(csv, "interned", depth, "build", reps, [&] {
+                return factory.getCoffee(BaseId::Simple, addOns.begin(), addOns.end())->layerCost();
+            });
+            measureDepthOp(csv, "interned", depth, "cost", reps, [&] { return interned->cost(); });
+            measureDepthOp(csv, "interned", depth, "description", reps,
+                           [&] { return static_cast<double>(interned->getDescription().size()); });
+        }
+
+        // Inline opcode array
+        if (depth <= Drink::kMaxAddOns) {
+            auto buildDrink = [&addOns] {
+                Drink drink;
+                for (AddOnId addOn : addOns) {
+                    drink.add(addOn);
+                }
+                return drink;
+            };
+            Drink drink = buildDrink();
+            measureDepthOp(csv, "drink", depth, "build", reps,
+                           [&] { return static_cast<double>(buildDrink().size()); });
+            measureDepthOp(csv, "drink", depth, "cost", reps, [&] { return drink.cost(); });
+            measureDepthOp(csv, "drink", depth, "description", reps,
+                           [&] { return static_cast<double>(drink.getDescription().size()); });
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "--bench-pricing") {
+        return runPricingBenchmark(argc > 2 ? std::stoull(argv[2]) : 10000000);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bench-depth") {
+        return runDepthBenchmark(argc > 2 ? std::stoull(argv[2]) : 10000);
+    }
+
     // Create a simple coffee (base component)
     std::shared_ptr<Coffee> myCoffee = std::make_shared<SimpleCoffee>();
 
@@ -101,5 +1122,83 @@ int main() {
     std::cout << "Description: " << myCoffee->getDescription() << std::endl;
     std::cout << "Total Cost: $" << myCoffee->cost() << std::endl;
 
+    // Integer cents from the hot-reloadable price table
+    const PriceTable& launchPrices = PriceList::current();
+    std::cout << "In cents (prices v" << launchPrices.version << "): "
+              << formatCents(priceInCents(*myCoffee)) << std::endl;
+    std::istringstream update("# afternoon prices\nMilk=65\nWhipped Cream=120\n");
+    PriceList::reload(update);
+    std::cout << "After reload (prices v" << PriceList::current().version << "): "
+              << formatCents(priceInCents(*myCoffee)) << " (cost() $" << myCoffee->cost()
+              << "), launch prices still give " << formatCents(priceInCents(*myCoffee, launchPrices)) << std::endl;
+
+    // Cache the evaluation; repeat queries no longer walk the chain
+    auto milky = std::make_shared<MilkDecorator>(std::make_shared<SimpleCoffee>());
+    auto order = std::make_shared<SugarDecorator>(milky);
+    CachedCoffee cached(order);
+    std::cout << "Cached: " << cached.cachedDescription() << " $" << cached.cost() << std::endl;
+
+    // Changing a layer invalidates the cached result
+    milky->rewrap(std::make_shared<WhippedCreamDecorator>(std::make_shared<SimpleCoffee>()));
+    std::cout << "After rewrap: " << cached.cachedDescription() << " $" << cached.cost() << std::endl;
+
+    // Fixed recipes resolve at compile time and can still be wrapped at runtime
+    using MilkAndSugar = Decorated<SimpleCoffee, Milk, Sugar>;
+    static_assert(MilkAndSugar::label == "Simple Coffee, Milk, Sugar", "recipe text is built at compile time");
+    std::shared_ptr<Coffee> recipe = std::make_shared<MilkAndSugar>();
+    recipe = std::make_shared<WhippedCreamDecorator>(recipe);
+    std::cout << "Recipe: " << recipe->getDescription() << " $" << recipe->cost() << std::endl;
+
+    // Runtime-configured drink as an inline opcode array
+    Drink drink;
+    drink.add(AddOnId::Milk);
+    drink.add(AddOnId::Milk);
+    drink.add(AddOnId::Sugar);
+    std::cout << "Drink (" << sizeof(Drink) << " bytes): " << drink.getDescription()
+              << " $" << drink.cost() << std::endl;
+
+    // Bulk pricing over columnar orders
+    OrderBatch batch;
+    batch.add(drink);
+    Drink plain;
+    batch.add(plain);
+    std::vector<double> totals;
+    batch.priceAll(totals);
+    std::cout << "Batch totals:";
+    for (double total : totals) {
+        std::cout << " $" << total;
+    }
+    std::cout << std::endl;
+
+    // Identical recipes share one immutable chain
+    CoffeeFactory factory;
+    for (int customer = 0; customer < 1000; ++customer) {
+        factory.getCoffee(BaseId::Simple, {AddOnId::Milk, AddOnId::Sugar});
+    }
+    auto shared = factory.getCoffee(BaseId::Simple, {AddOnId::Milk, AddOnId::Sugar});
+    auto withCream = factory.getCoffee(BaseId::Simple, {AddOnId::Milk, AddOnId::Sugar, AddOnId::WhippedCream});
+    std::cout << "Shared recipe: " << shared->getDescription() << " $" << shared->cost()
+              << (withCream->inner() == shared.get() ? " (prefix of the cream order)" : "") << std::endl;
+    factory.printStats(std::cout);
+
+    // A per-order arena holds the whole chain and rewinds when it is dropped
+    CoffeeArena arena;
+    {
+        std::shared_ptr<Coffee> arenaCoffee = makeCoffee<SimpleCoffee>(&arena);
+        arenaCoffee = makeCoffee<MilkDecorator>(&arena, arenaCoffee);
+        arenaCoffee = makeCoffee<WhippedCreamDecorator>(&arena, arenaCoffee);
+        std::cout << "Arena order: " << arenaCoffee->getDescription() << " $" << arenaCoffee->cost()
+                  << " (" << arena.liveAllocations() << " layers in the arena)" << std::endl;
+    }
+    std::cout << "Arena layers after the order: " << arena.liveAllocations() << std::endl;
+
+    // Overlapping orders share the thread's pool, which reuses freed layers
+    std::shared_ptr<Coffee> regular = makeCoffee<MilkDecorator>(CoffeeArena::forThread(),
+                                                                makeCoffee<SimpleCoffee>(CoffeeArena::forThread()));
+    for (int order = 0; order < 1000; ++order) {
+        makeCoffee<SugarDecorator>(CoffeeArena::forThread(), regular);
+    }
+    std::cout << "Thread pool order: " << regular->getDescription() << " $" << regular->cost() << std::endl;
+
     return 0;
 }
\ No newline at end of file
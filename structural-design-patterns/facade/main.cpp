@@ -7,61 +7,297 @@
  * This demonstrates how the Facade pattern provides a unified, high-level interface
  * to a set of interfaces in a subsystem, making the subsystem easier to use.
  * The client interacts only with the Facade, not with the individual subsystem classes.
+ *
+ * Behind the facade, startup and shutdown are declared as a StepGraph: each step names the
+ * steps it waits for, and independent steps run concurrently. Screen, projector, sound and
+ * DVD player all start at once, and playback waits only for what it needs. Subsystems can
+ * simulate slow hardware with a per-call delay, which shows the shorter time-to-first-frame.
+ *
+ * The facade can trace itself: when its Tracer is enabled, every step and every high-level
+ * call is recorded as a monotonic-clock span in a fixed-size, lock-free buffer, and the
+ * spans export as Chrome trace-event JSON (chrome://tracing or Perfetto), together with the
+ * number of spans dropped because the buffer was full; clear() empties it for the next
+ * session. When tracing is off, a traced call costs one branch on a relaxed atomic load.
  */
 
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Serializes console output from steps running on different threads
+inline void announce(const std::string& message) {
+    static std::mutex outputMutex;
+    std::lock_guard<std::mutex> lock(outputMutex);
+    std::cout << message << std::endl;
+}
+
+// Common base for subsystems: each call takes `delay`, like real hardware would
+class Device {
+public:
+    explicit Device(std::chrono::milliseconds d) : delay(d) {}
+
+protected:
+    void settle() const {
+        if (delay.count() > 0) {
+            std::this_thread::sleep_for(delay);
+        }
+    }
+
+private:
+    std::chrono::milliseconds delay;
+};
 
 // Subsystem 1: Projector
-class Projector {
+class Projector : public Device {
 public:
+    explicit Projector(std::chrono::milliseconds delay = std::chrono::milliseconds(0)) : Device(delay) {}
     void turnOn() {
-        std::cout << "Projector is now ON." << std::endl;
+        settle();
+        announce("Projector is now ON.");
     }
     void turnOff() {
-        std::cout << "Projector is now OFF." << std::endl;
+        settle();
+        announce("Projector is now OFF.");
     }
 };
 
 // Subsystem 2: SoundSystem
-class SoundSystem {
+class SoundSystem : public Device {
 public:
+    explicit SoundSystem(std::chrono::milliseconds delay = std::chrono::milliseconds(0)) : Device(delay) {}
     void turnOn() {
-        std::cout << "Sound System is now ON." << std::endl;
+        settle();
+        announce("Sound System is now ON.");
     }
     void turnOff() {
-        std::cout << "Sound System is now OFF." << std::endl;
+        settle();
+        announce("Sound System is now OFF.");
     }
     void setVolume(int level) {
-        std::cout << "Setting sound system volume to " << level << "." << std::endl;
+        settle();
+        announce("Setting sound system volume to " + std::to_string(level) + ".");
     }
-}; 
+};
 
 // Subsystem 3: DVDPlayer
-class DVDPlayer {
+class DVDPlayer : public Device {
 public:
+    explicit DVDPlayer(std::chrono::milliseconds delay = std::chrono::milliseconds(0)) : Device(delay) {}
     void turnOn() {
-        std::cout << "DVD Player is now ON." << std::endl;
+        settle();
+        announce("DVD Player is now ON.");
     }
     void turnOff() {
-        std::cout << "DVD Player is now OFF." << std::endl;
+        settle();
+        announce("DVD Player is now OFF.");
     }
     void playMovie(const std::string& movie) {
-        std::cout << "Playing movie: " << movie << std::endl;
+        settle();
+        announce("Playing movie: " + movie);
     }
 };
 
 // Subsystem 4: Screen
-class Screen {
+class Screen : public Device {
 public:
+    explicit Screen(std::chrono::milliseconds delay = std::chrono::milliseconds(0)) : Device(delay) {}
     void lower() {
-        std::cout << "Screen is now lowered." << std::endl;
+        settle();
+        announce("Screen is now lowered.");
     }
     void raise() {
-        std::cout << "Screen is now raised." << std::endl;
+        settle();
+        announce("Screen is now raised.");
     }
 };
 
+// Records spans into a fixed number of slots. Writers claim a slot with one
+// fetch_add and publish it with a release store, so recording never locks;
+// spans that arrive once the buffer is full are counted as dropped, and the
+// count is part of the export. Export and then clear() to reuse the buffer
+// for long sessions.
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Tracer(std::size_t capacity = 4096)
+        : slots(new Slot[capacity]), capacity(capacity), epoch(Clock::now()) {}
+
+    void enable() { on.store(true, std::memory_order_relaxed); }
+    void disable() { on.store(false, std::memory_order_relaxed); }
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    // Runs fn, recording it as a span when tracing is on. `name` is kept by
+    // pointer, so it must outlive the tracer (a string literal, typically).
+    template <typename Fn>
+    void span(const char* name, Fn&& fn) {
+        if (!enabled()) {
+            fn();
+            return;
+        }
+        const Clock::time_point start = Clock::now();
+        fn();
+        record(name, start, Clock::now());
+    }
+
+    void record(const char* name, Clock::time_point start, Clock::time_point end) {
+        const std::size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Slot& slot = slots[index];
+        slot.name = name;
+        slot.startNs = nanosecondsSinceEpoch(start);
+        slot.durationNs = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        slot.thread = threadNumber();
+        slot.ready.store(true, std::memory_order_release);
+    }
+
+    std::size_t droppedSpans() const { return dropped.load(std::memory_order_relaxed); }
+
+    // Empties the buffer and resets the dropped count, typically right after
+    // an export. No span may be in flight: call it between facade calls, not
+    // while one is running on another thread.
+    void clear() {
+        const std::size_t claimed = std::min(next.load(std::memory_order_acquire), capacity);
+        for (std::size_t i = 0; i < claimed; ++i) {
+            slots[i].ready.store(false, std::memory_order_relaxed);
+        }
+        dropped.store(0, std::memory_order_relaxed);
+        next.store(0, std::memory_order_release);
+    }
+
+    // Writes every completed span as a Chrome "complete" event; times are in
+    // microseconds since the tracer was created. Spans lost to a full buffer
+    // are reported as otherData.droppedSpans.
+    void exportChromeTrace(std::ostream& out) const {
+        const std::size_t claimed = std::min(next.load(std::memory_order_acquire), capacity);
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for (std::size_t i = 0; i < claimed; ++i) {
+            const Slot& slot = slots[i];
+            if (!slot.ready.load(std::memory_order_acquire)) {
+                continue;
+            }
+            out << (first ? "\n" : ",\n") << "{\"name\":\"";
+            for (const char* c = slot.name; *c; ++c) {
+                if (*c == '"' || *c == '\\') {
+                    out << '\\';
+                }
+                out << *c;
+            }
+            out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << slot.thread
+                << ",\"ts\":" << slot.startNs / 1000 << '.' << threeDigits(slot.startNs % 1000)
+                << ",\"dur\":" << slot.durationNs / 1000 << '.' << threeDigits(slot.durationNs % 1000) << '}';
+            first = false;
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedSpans\":" << droppedSpans() << "}}"
+            << std::endl;
+    }
+
+private:
+    struct Slot {
+        const char* name = nullptr;
+        std::uint64_t startNs = 0;
+        std::uint64_t durationNs = 0;
+        std::uint32_t thread = 0;
+        std::atomic<bool> ready{false};
+    };
+
+    std::uint64_t nanosecondsSinceEpoch(Clock::time_point time) const {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count());
+    }
+
+    // Small, stable per-thread ids read better in the trace viewer than
+    // std::thread::id hashes
+    static std::uint32_t threadNumber() {
+        static std::atomic<std::uint32_t> threads{0};
+        thread_local std::uint32_t number = threads.fetch_add(1, std::memory_order_relaxed) + 1;
+        return number;
+    }
+
+    static std::string threeDigits(std::uint64_t value) {
+        std::string digits = std::to_string(value);
+        return std::string(3 - digits.size(), '0') + digits;
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    std::size_t capacity;
+    Clock::time_point epoch;
+    std::atomic<bool> on{false};
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> dropped{0};
+};
+
+// Steps plus the steps each one waits for. A step may only depend on steps
+// added before it, so the graph is acyclic by construction. run() starts
+// every step as soon as its dependencies have finished, as a span named
+// after the step.
+class StepGraph {
+public:
+    using StepId = std::size_t;
+
+    explicit StepGraph(Tracer& t) : tracer(t) {}
+
+    // `name` is recorded by pointer in traces, so pass a string literal
+    StepId add(const char* name, std::function<void()> action, std::vector<StepId> dependsOn = {}) {
+        for (StepId dependency : dependsOn) {
+            if (dependency >= steps.size()) {
+                throw std::invalid_argument(std::string("step '") + name + "' depends on a step that is not declared yet");
+            }
+        }
+        steps.push_back(Step{name, std::move(action), std::move(dependsOn)});
+        return steps.size() - 1;
+    }
+
+    // Runs the graph and waits for every step. If a step throws, the steps
+    // that depend on it are skipped and the first failure is rethrown.
+    void run() {
+        std::vector<std::shared_future<void>> done;
+        done.reserve(steps.size());
+        for (const Step& step : steps) {
+            std::vector<std::shared_future<void>> prerequisites;
+            for (StepId dependency : step.dependsOn) {
+                prerequisites.push_back(done[dependency]);
+            }
+            done.push_back(std::async(std::launch::async, [this, &step, prerequisites] {
+                for (const auto& prerequisite : prerequisites) {
+                    prerequisite.get();
+                }
+                tracer.span(step.name, step.action);
+            }).share());
+        }
+        for (const auto& step : done) {
+            step.wait();
+        }
+        for (const auto& step : done) {
+            step.get();
+        }
+    }
+
+private:
+    struct Step {
+        const char* name;
+        std::function<void()> action;
+        std::vector<StepId> dependsOn;
+    };
+    Tracer& tracer;
+    std::vector<Step> steps;
+};
+
 // Facade Class: Provides a simple interface to control the home theater system
 class HomeTheaterFacade {
 private:
@@ -69,33 +305,54 @@ private:
     std::unique_ptr<SoundSystem> soundSystem;
     std::unique_ptr<DVDPlayer> dvdPlayer;
     std::unique_ptr<Screen> screen;
+    Tracer tracer;
 
 public:
-    // Constructor initializes all subsystems
-    HomeTheaterFacade()
-        : projector(std::make_unique<Projector>()),
-          soundSystem(std::make_unique<SoundSystem>()),
-          dvdPlayer(std::make_unique<DVDPlayer>()),
-          screen(std::make_unique<Screen>()) {}
-
-    // High-level method to start watching a movie
+    // Constructor initializes all subsystems; hardwareDelay simulates how
+    // long each subsystem call takes
+    explicit HomeTheaterFacade(std::chrono::milliseconds hardwareDelay = std::chrono::milliseconds(0))
+        : projector(std::make_unique<Projector>(hardwareDelay)),
+          soundSystem(std::make_unique<SoundSystem>(hardwareDelay)),
+          dvdPlayer(std::make_unique<DVDPlayer>(hardwareDelay)),
+          screen(std::make_unique<Screen>(hardwareDelay)) {}
+
+    // High-level method to start watching a movie: devices start in
+    // parallel and playback waits only for the steps it needs
     void watchMovie(const std::string& movie) {
-        std::cout << "Getting ready to watch a movie..." << std::endl;
-        screen->lower();
-        projector->turnOn();
-        soundSystem->turnOn();
-        soundSystem->setVolume(5);
-        dvdPlayer->turnOn();
-        dvdPlayer->playMovie(movie);
+        tracer.span("watchMovie", [this, &movie] { startMovie(movie); });
     }
 
-    // High-level method to end the movie and shut down the system
+    // High-level method to end the movie and shut down the system: playback
+    // stops first, then the remaining devices power down together
     void endMovie() {
-        std::cout << "Shutting down home theater..." << std::endl;
-        dvdPlayer->turnOff();
-        soundSystem->turnOff();
-        projector->turnOff();
-        screen->raise();
+        tracer.span("endMovie", [this] { stopMovie(); });
+    }
+
+    // Spans for every subsystem call; off until enabled
+    Tracer& tracing() { return tracer; }
+
+private:
+    void startMovie(const std::string& movie) {
+        announce("Getting ready to watch a movie...");
+        StepGraph startup(tracer);
+        auto lowerScreen = startup.add("screen.lower", [this] { screen->lower(); });
+        auto projectorOn = startup.add("projector.turnOn", [this] { projector->turnOn(); });
+        auto soundOn = startup.add("soundSystem.turnOn", [this] { soundSystem->turnOn(); });
+        auto volume = startup.add("soundSystem.setVolume", [this] { soundSystem->setVolume(5); }, {soundOn});
+        auto dvdOn = startup.add("dvdPlayer.turnOn", [this] { dvdPlayer->turnOn(); });
+        startup.add("dvdPlayer.playMovie", [this, movie] { dvdPlayer->playMovie(movie); },
+                    {lowerScreen, projectorOn, volume, dvdOn});
+        startup.run();
+    }
+
+    void stopMovie() {
+        announce("Shutting down home theater...");
+        StepGraph shutdown(tracer);
+        auto dvdOff = shutdown.add("dvdPlayer.turnOff", [this] { dvdPlayer->turnOff(); });
+        shutdown.add("soundSystem.turnOff", [this] { soundSystem->turnOff(); }, {dvdOff});
+        shutdown.add("projector.turnOff", [this] { projector->turnOff(); }, {dvdOff});
+        shutdown.add("screen.raise", [this] { screen->raise(); }, {dvdOff});
+        shutdown.run();
     }
 };
 
@@ -109,5 +366,22 @@ int main() {
     homeTheater.endMovie();
     std::cout << "Movie ended. Home theater is now off." << std::endl;
 
+    // With slow hardware, independent steps overlap: six 100 ms calls
+    // reach the first frame after three of them instead of all six
+    HomeTheaterFacade slowTheater(std::chrono::milliseconds(100));
+    slowTheater.tracing().enable();
+    auto start = std::chrono::steady_clock::now();
+    slowTheater.watchMovie("Inception");
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "First frame after about " << (elapsed.count() + 50) / 100 * 100
+              << " ms (600 ms if run one step at a time)" << std::endl;
+    slowTheater.endMovie();
+
+    // Every step as a span; load the JSON in chrome://tracing or Perfetto.
+    // Clearing after the export makes room for the next session's spans.
+    std::cout << "Chrome trace:" << std::endl;
+    slowTheater.tracing().exportChromeTrace(std::cout);
+    slowTheater.tracing().clear();
+
     return 0;
-}
\ No newline at end of file
+}